@@ -3,7 +3,8 @@
 //#define TESTFAIL
 
 #include <Arduino.h>
-#include "RingBuffer.h"
+#include "config.h"
+#include "spsc_ring.h"
 
 const uint8_t crc_table_crc8[256] PROGMEM = { 0,213,127,170,254,43,129,84,41,252,86,131,215,2,168,125,82,135,45,248,172,121,211,6,123,174,4,209,133,80,250,47,164,113,219,14,90,143,37,240,141,88,242,39,115,166,12,217,246,35,137,92,8,221,119,162,223,10,160,117,33,244,94,139,157,72,226,55,99,182,28,201,180,97,203,30,74,159,53,224,207,26,176,101,49,228,78,155,230,51,153,76,24,205,103,178,57,236,70,147,199,18,184,109,16,197,111,186,238,59,145,68,107,190,20,193,149,64,234,63,66,151,61,232,188,105,195,22,239,58,144,69,17,196,110,187,198,19,185,108,56,237,71,146,189,104,194,23,67,150,60,233,148,65,235,62,106,191,21,192,75,158,52,225,181,96,202,31,98,183,29,200,156,73,227,54,25,204,102,179,231,50,152,77,48,229,79,154,206,27,177,100,114,167,13,216,140,89,243,38,91,142,36,241,165,112,218,15,32,245,95,138,222,11,161,116,9,220,118,163,247,34,136,93,214,3,169,124,40,253,87,130,255,42,128,85,1,212,126,171,132,81,251,46,122,175,5,208,173,120,210,7,83,134,44,249 };
 #define updateCrc(currentCrc, value) pgm_read_byte(&crc_table_crc8[currentCrc ^ value]);
@@ -14,9 +15,20 @@ class ARQSerial
 {
 private:
 
-	byte partialdatabuffer[24];
+	byte partialdatabuffer[32];
 	int Arq_LastValidPacket = 255;
-	RingBuffer<uint8_t, 32> DataBuffer;
+	SpscRing<uint8_t, ARQ_DATA_BUFFER_SIZE> DataBuffer;
+
+#if ARQ_WINDOW_SIZE > 1
+	// Packets received ahead of the next expected one, already acknowledged
+	struct ArqSlot {
+		uint8_t id;
+		uint8_t length;  // 0 = free
+		byte data[32];
+	};
+
+	ArqSlot window[ARQ_WINDOW_SIZE - 1] = {};
+#endif
 	IdleFunction idleFunction = 0;
 
 #ifdef TESTFAIL
@@ -24,115 +36,205 @@ private:
 	int testfailidx2 = 0;
 #endif
 
-	int Arq_TimedRead()
-	{
-		int c;
-		unsigned long fsr_startMillis = millis();
-		do {
-			if (idleFunction != 0) idleFunction(true);
-			c = Serial.read();
-			if (c >= 0) {
-#ifdef TESTFAIL
-				testfailidx = (testfailidx + 1) % 5000;
-				if (testfailidx == 500)
-					return random(255);
+	// Packet reception state, bytes are consumed as they arrive so a partial
+	// packet never blocks the caller
+	enum ArqState : uint8_t {
+		ARQ_HEADER,
+		ARQ_HEADER2,
+		ARQ_PACKET_ID,
+		ARQ_LENGTH,
+		ARQ_DATA,
+		ARQ_CRC
+	};
+
+	ArqState state = ARQ_HEADER;
+	uint8_t packetID = 0;
+	uint8_t length = 0;
+	uint8_t received = 0;
+	byte currentCrc = 0;
+	unsigned long lastByteMillis = 0;
+
+	// Packet IDs run from 0 to 128, 255 restarts the sequence
+	int NextPacketId() {
+		return Arq_LastValidPacket > 127 ? 0 : Arq_LastValidPacket + 1;
+	}
 
-				if (testfailidx == 1000)
-					return -1;
-#endif
-				return c;
-			}
-		} while (millis() - fsr_startMillis < 100);
-		return -1;
+#if ARQ_WINDOW_SIZE > 1
+	// How far a packet ID is ahead of the next expected one, IDs wrap after 128
+	static uint8_t WindowOffset(uint8_t id, int next) {
+		return (id + 129 - next) % 129;
 	}
+#endif
 
-	void ProcessIncomingData() {
-		int packetID, length, header, res, i, crc, nextpacketid;
-		byte currentCrc;
+	// Moves a packet to the data buffer, false if it does not fit yet
+	bool Deliver(const byte* data, uint8_t len) {
+		if (DataBuffer.capacity() - DataBuffer.size() < len) {
+			return false;
+		}
+		DataBuffer.push(data, len);
+		return true;
+	}
 
-		while (Serial.available() > 0) {
-			header = Arq_TimedRead();
-			//DebugPrintLn("hello1");
-			currentCrc = 0;
+	void DrainWindow() {
+#if ARQ_WINDOW_SIZE > 1
+		bool delivered = true;
+		while (delivered) {
+			delivered = false;
+			int next = NextPacketId();
+			for (uint8_t i = 0; i < ARQ_WINDOW_SIZE - 1; ++i) {
+				ArqSlot& slot = window[i];
+				if (slot.length && slot.id == next && Deliver(slot.data, slot.length)) {
+					slot.length = 0;
+					Arq_LastValidPacket = next;
+					delivered = true;
+					break;
+				}
+			}
+		}
+#endif
+	}
 
-			if (header == 0x01) {
-				byte reason = 0x00;
+	void AcceptPacket() {
+		int nextpacketid = NextPacketId();
 
-				header = Arq_TimedRead();
-				if (header != 0x01) {
-					return;
+		if (packetID == nextpacketid || packetID == 255) {
+			if (!Deliver(partialdatabuffer, length)) {
+				// No room, not acknowledging makes SimHub send it again
+				return;
+			}
+			Arq_LastValidPacket = packetID;
+#if ARQ_WINDOW_SIZE > 1
+			if (packetID == 255) {
+				for (uint8_t i = 0; i < ARQ_WINDOW_SIZE - 1; ++i) {
+					window[i].length = 0;
 				}
-
-				if (reason == 0) {
-					packetID = Arq_TimedRead();
-					if (packetID < 0) {
-						reason = 0x01;
-					}
+			}
+#endif
+			DrainWindow();
+		}
+#if ARQ_WINDOW_SIZE > 1
+		else if (packetID <= 128 && WindowOffset(packetID, nextpacketid) < ARQ_WINDOW_SIZE) {
+			// Ahead within the window, held until the packets before it arrive
+			ArqSlot* free = 0;
+			bool duplicate = false;
+			for (uint8_t i = 0; i < ARQ_WINDOW_SIZE - 1; ++i) {
+				ArqSlot& slot = window[i];
+				if (slot.length && WindowOffset(slot.id, nextpacketid) >= ARQ_WINDOW_SIZE) {
+					// No longer ahead of the expected packet, it can never be delivered
+					slot.length = 0;
 				}
-
-				if (reason == 0) {
-					length = Arq_TimedRead();
-					if (length <= 0 || length > 32) {
-						reason = 0x02;
-					}
+				if (slot.length && slot.id == packetID) {
+					duplicate = true;
+					break;
 				}
-
-				if (reason == 0)
-				{
-					for (i = 0; i < length && !reason; i++) {
-						res = Arq_TimedRead();
-						partialdatabuffer[i] = res;
-						if (res < 0) reason = 0x05;
-					}
+				if (!slot.length && !free) {
+					free = &slot;
 				}
-
-				if (reason == 0) {
-					crc = Arq_TimedRead();
-					if (crc < 0) {
-						reason = 0x03;
-					}
+			}
+			if (!duplicate) {
+				if (!free) {
+					// Not kept, not acknowledging makes SimHub send it again
+					return;
 				}
+				free->id = packetID;
+				free->length = length;
+				memcpy(free->data, partialdatabuffer, length);
+			}
+		}
+#endif
+		// Anything else is a resend of a packet that was already received
+#ifdef TESTFAIL
+		testfailidx = (testfailidx + 1) % 5000;
+		if (testfailidx != 788) {
+			SendAcq(packetID);
+		}
+#else
+		SendAcq(packetID);
+#endif
+	}
 
-				if (reason == 0) {
-					currentCrc = updateCrc(currentCrc, packetID);
-					currentCrc = updateCrc(currentCrc, length);
-					for (i = 0; i < length; i++) {
-						currentCrc = updateCrc(currentCrc, partialdatabuffer[i]);
-					}
-
-					if (crc != currentCrc) {
-						reason = 0x04;
-					}
-				}
+	void ProcessIncomingData() {
+		DrainWindow();
+
+		// A packet that stalls for 100 ms is rejected with the reason of the missing part
+		if (state != ARQ_HEADER && millis() - lastByteMillis >= 100) {
+			byte reason = 0x00;
+			switch (state) {
+				case ARQ_PACKET_ID: reason = 0x01; break;
+				case ARQ_LENGTH:    reason = 0x02; break;
+				case ARQ_DATA:      reason = 0x05; break;
+				case ARQ_CRC:       reason = 0x03; break;
+				default: break;
+			}
+			if (reason > 0) {
+				SendNAcq(Arq_LastValidPacket, reason);
+			}
+			state = ARQ_HEADER;
+		}
 
-				if (reason == 0) {
-					nextpacketid = Arq_LastValidPacket > 127 ? 0 : Arq_LastValidPacket + 1;
+		while (Serial.available() > 0) {
+			int c = Serial.read();
+			if (c < 0) {
+				break;
+			}
+#ifdef TESTFAIL
+			testfailidx2 = (testfailidx2 + 1) % 5000;
+			if (testfailidx2 == 500)
+				c = random(255);
 
-					if (packetID == nextpacketid || packetID == 255) {
-						for (i = 0; i < length; i++) {
-							DataBuffer.push(partialdatabuffer[i]);
-						}
-						Arq_LastValidPacket = packetID;
+			if (testfailidx2 == 1000)
+				continue;
+#endif
+			lastByteMillis = millis();
+
+			switch (state) {
+				case ARQ_HEADER:
+					if (c == 0x01) state = ARQ_HEADER2;
+					break;
+
+				case ARQ_HEADER2:
+					state = c == 0x01 ? ARQ_PACKET_ID : ARQ_HEADER;
+					break;
+
+				case ARQ_PACKET_ID:
+					packetID = c;
+					currentCrc = updateCrc(0, packetID);
+					state = ARQ_LENGTH;
+					break;
+
+				case ARQ_LENGTH:
+					if (c <= 0 || c > (int)sizeof(partialdatabuffer)) {
+						SendNAcq(Arq_LastValidPacket, 0x02);
+						state = ARQ_HEADER;
+						break;
 					}
-#ifdef TESTFAIL
-					testfailidx = (testfailidx + 1) % 5000;
-					if (testfailidx != 788) {
-						SendAcq(packetID);
+					length = c;
+					received = 0;
+					currentCrc = updateCrc(currentCrc, length);
+					state = ARQ_DATA;
+					break;
+
+				case ARQ_DATA:
+					partialdatabuffer[received++] = c;
+					currentCrc = updateCrc(currentCrc, (byte)c);
+					if (received == length) state = ARQ_CRC;
+					break;
+
+				case ARQ_CRC:
+					if (c != currentCrc) {
+						SendNAcq(Arq_LastValidPacket, 0x04);
+					} else {
+						AcceptPacket();
 					}
-#else
-					SendAcq(packetID);
-#endif
-				}
-
-				if (reason > 0) {
-					SendNAcq(Arq_LastValidPacket, reason);
-				}
+					state = ARQ_HEADER;
+					break;
 			}
 		}
 	}
 
 	void SendAcq(uint8_t packetId)
 	{
+		validPackets++;
 		Serial.write(0x03);
 		Serial.write(packetId);
 		Serial.flush();
@@ -140,6 +242,7 @@ private:
 
 	void SendNAcq(uint8_t lastKnownValidPacket, byte reason)
 	{
+		failedPackets++;
 		Serial.write(0x04);
 		Serial.write(lastKnownValidPacket);
 		Serial.write(reason);
@@ -148,6 +251,10 @@ private:
 
 public:
 
+	// Link quality, reset by the user
+	uint16_t validPackets = 0;
+	uint16_t failedPackets = 0;
+
 	void setIdleFunction(IdleFunction function) {
 		idleFunction = function;
 	}
@@ -184,6 +291,23 @@ public:
 		return -1;
 	}
 
+	// Like read() but leaves the byte in the buffer
+	int peek() {
+		unsigned long fsr_startMillis = millis();
+		do {
+			if (idleFunction != 0) idleFunction(false);
+
+			uint8_t res = 0;
+			if (DataBuffer.peek(res)) {
+				return (int)res;
+			}
+
+			ProcessIncomingData();
+		} while (millis() - fsr_startMillis < 400);
+
+		return -1;
+	}
+
 	int Available() {
 		if (idleFunction != 0) idleFunction(false);
 		if (DataBuffer.size() == 0) {
@@ -280,6 +404,32 @@ public:
 		
 	}
 
+	// Like ReadStringUntil(terminator).toInt() but without building a String
+	long ReadIntUntil(char terminator) {
+		long value = 0;
+		bool negative = false;
+		bool digits = true;
+		int c = read();
+
+		while (c == ' ') {
+			c = read();
+		}
+		if (c == '-') {
+			negative = true;
+			c = read();
+		}
+		while (c >= 0 && c != terminator) {
+			// Anything after the number, like decimals, is skipped
+			if (digits && c >= '0' && c <= '9') {
+				value = value * 10 + (c - '0');
+			} else {
+				digits = false;
+			}
+			c = read();
+		}
+		return negative ? -value : value;
+	}
+
 	String ReadStringUntil(char terminator1) {
 		String ret;
 		int c = read();
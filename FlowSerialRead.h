@@ -6,11 +6,13 @@ ARQSerial arqserial;
 
 #define FlowSerialAvailable() arqserial.Available()
 #define FlowSerialTimedRead() arqserial.read()
+#define FlowSerialTimedPeek() arqserial.peek()
 #define  FlowSerialWrite(data) arqserial.Write(data)
 
 String FlowSerialReadStringUntil(char terminator) { return arqserial.ReadStringUntil(terminator); }
 String FlowSerialReadStringUntil(char terminator1, char terminator2) { return arqserial.ReadStringUntil(terminator1, terminator2); }
 void FlowSerialReadStringUntil(char buffer[], char terminator){ arqserial.ReadStringUntil(buffer, terminator); }
+long FlowSerialReadIntUntil(char terminator) { return arqserial.ReadIntUntil(terminator); }
 
 void FlowSerialPrint(String& data) { arqserial.WriteString(data); }
 void FlowSerialPrint(char data){	arqserial.Print(data);}
@@ -21,26 +23,88 @@ void FlowSerialPrintLn(String& data){	arqserial.PrintLn(data);}
 void FlowSerialPrintLn(const char str[]) {	arqserial.PrintLn(str);}
 void FlowSerialPrintLn() { arqserial.PrintLn();}
 
+// Rates of the '8' command by index, 0 is unused
+const uint32_t simHubBaudrates[] PROGMEM = {
+	0, 300, 1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400, 57600,
+	115200, 230400, 250000, 1000000, 2000000, 200000, 500000
+};
+
+#define SIMHUB_BAUDRATE_COUNT (sizeof(simHubBaudrates) / sizeof(simHubBaudrates[0]))
+
+uint32_t simHubBaudrate(uint8_t index) {
+	return index < SIMHUB_BAUDRATE_COUNT ? pgm_read_dword(&simHubBaudrates[index]) : 0;
+}
+
+// Rate switching is deferred so the loop keeps running while the host changes its rate.
+// The host picks the rate and cannot be told to change it, so the board only leaves it
+// when the host must have noticed the link failing too, see SimHubBaudService()
+struct SimHubBaudState {
+	uint32_t current = SIMHUB_SERIAL_BAUD;
+	uint32_t pending = 0;
+	uint32_t failed = 0;         // Lowest rate that did not work, 0 if none
+	unsigned long switchAt = 0;
+	unsigned long verifySince = 0;
+	bool verified = true;
+} simHubBaud;
+
 void SetBaudrate() {
-	int br = FlowSerialTimedRead();
-
-	delay(200);
-
-	if (br == 1) FlowSerialBegin(300);
-	if (br == 2) FlowSerialBegin(1200);
-	if (br == 3) FlowSerialBegin(2400);
-	if (br == 4) FlowSerialBegin(4800);
-	if (br == 5) FlowSerialBegin(9600);
-	if (br == 6) FlowSerialBegin(14400);
-	if (br == 7) FlowSerialBegin(19200);
-	if (br == 8) FlowSerialBegin(28800);
-	if (br == 9) FlowSerialBegin(38400);
-	if (br == 10) FlowSerialBegin(57600);
-	if (br == 11) FlowSerialBegin(115200);
-	if (br == 12) FlowSerialBegin(230400);
-	if (br == 13) FlowSerialBegin(250000);
-	if (br == 14) FlowSerialBegin(1000000);
-	if (br == 15) FlowSerialBegin(2000000);
-	if (br == 16) FlowSerialBegin(200000);
-	if (br == 17) FlowSerialBegin(500000);
-}
\ No newline at end of file
+	uint32_t rate = simHubBaudrate(FlowSerialTimedRead());
+
+	// Unknown, unsupported or already failed rates are ignored and the host falls
+	// back to the base rate when the link times out
+	if (rate == 0 || rate > SIMHUB_MAX_BAUD || (simHubBaud.failed && rate >= simHubBaud.failed)) {
+		return;
+	}
+
+	simHubBaud.pending = rate;
+	simHubBaud.switchAt = millis() + 200;
+}
+
+void SimHubBaudBegin(uint32_t rate) {
+	FlowSerialBegin(rate);
+	simHubBaud.current = rate;
+	simHubBaud.verifySince = millis();
+	simHubBaud.verified = rate == SIMHUB_SERIAL_BAUD;
+	arqserial.validPackets = 0;
+	arqserial.failedPackets = 0;
+}
+
+void SimHubBaudReset() {
+	simHubBaud.pending = 0;
+	if (simHubBaud.current != SIMHUB_SERIAL_BAUD) {
+		SimHubBaudBegin(SIMHUB_SERIAL_BAUD);
+	}
+}
+
+void SimHubBaudService() {
+	if (simHubBaud.pending && (long)(millis() - simHubBaud.switchAt) >= 0) {
+		SimHubBaudBegin(simHubBaud.pending);
+		simHubBaud.pending = 0;
+		return;
+	}
+
+	if (simHubBaud.current == SIMHUB_SERIAL_BAUD) {
+		return;
+	}
+
+	uint16_t total = arqserial.validPackets + arqserial.failedPackets;
+	bool silent = !simHubBaud.verified && total == 0 && millis() - simHubBaud.verifySince > SIMHUB_BAUD_VERIFY_MS;
+	bool noisy = total >= 32 && arqserial.failedPackets * 100u > total * (uint16_t)SIMHUB_MAX_ERROR_PERCENT;
+
+	if (silent) {
+		// Nothing got through, so the host has had no acknowledgement either and
+		// reconnects at the base rate
+		simHubBaud.failed = simHubBaud.current;
+		SimHubBaudBegin(SIMHUB_SERIAL_BAUD);
+	} else if (total >= 32) {
+		// A noisy rate still works as failed packets are sent again. Switching now would
+		// leave the host sending at this rate, so it is only refused after the next reconnect.
+		if (noisy) {
+			simHubBaud.failed = simHubBaud.current;
+		} else {
+			simHubBaud.verified = true;
+		}
+		arqserial.validPackets = 0;
+		arqserial.failedPackets = 0;
+	}
+}
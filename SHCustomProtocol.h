@@ -4,56 +4,175 @@
 #include <Arduino.h>
 #include "types.h"
 #include "config.h"
+#include "serial_binary.h"
+
+// Compact update from simhub/custom_protocol_compact.js: this marker followed by
+// fixed width fields of base 64 digits ('0' + 0-63), most significant first
+#define SH_COMPACT_MARKER '#'
 
 extern SInput s_input;
 
 class SHCustomProtocol {
 private:
 
+	// Gear token is "N", "R" or the gear number
+	void readGear(GEAR& currentGear, GEAR_MANUAL& explicitGear) {
+		int c = FlowSerialTimedRead();
+
+		if (c == 'N' || c == 'R') {
+			explicitGear = NONE;
+			currentGear = c == 'N' ? NEUTRAL : REVERSE;
+			while (c >= 0 && c != ';') {
+				c = FlowSerialTimedRead();
+			}
+			return;
+		}
+
+		int gear = 0;
+		while (c >= 0 && c != ';') {
+			if (c >= '0' && c <= '9') {
+				gear = gear * 10 + (c - '0');
+			}
+			c = FlowSerialTimedRead();
+		}
+		explicitGear = (GEAR_MANUAL)(min(gear, NUMBER_OF_GEARS));
+		currentGear = DRIVE;
+	}
+
+	// Fields of the compact update in 'S' frame order as {frame bytes, digits}.
+	// Zero digits leaves the field out, one byte with no digits is a plain character
+	struct CompactField {
+		uint8_t bytes;
+		uint8_t digits;
+	};
+
+	// Decodes the compact update into an 'S' frame so both protocols share the parser
+	void readCompact() {
+		static const CompactField fields[] = {
+			{1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1}, // year - 2000, month, day, hour, minute, second
+			{2, 3}, {2, 3},                                 // rpm, speed
+			{1, 1}, {1, 2}, {1, 2},                         // gear, water temp, oil temp
+			{2, 2},                                         // fuel
+			{4, 6}, {1, 2},                                 // showlights, showlights ext
+			{2, 3},                                         // fuel injection
+			{2, 0}, {1, 0},                                 // custom light and its state, not sent
+			{1, 0xFF},                                      // gear extension character
+			{2, 2}, {1, 1},                                 // cruise speed, cruise status
+			{1, 1}, {1, 1},                                 // ignition, engine running
+			{2, 3},                                         // ambient temp
+		};
+
+		uint8_t frame[SERIAL_FRAME_LENGTH] = {'S'};
+		uint8_t pos = 1;
+		uint8_t sum = 0;
+
+		for (uint8_t f = 0; f < sizeof(fields) / sizeof(fields[0]); ++f) {
+			uint32_t value = 0;
+
+			if (fields[f].digits == 0xFF) {
+				int c = FlowSerialTimedRead();
+				if (c < 0) return;
+				sum += c - '0';
+				value = c;
+			} else {
+				for (uint8_t d = 0; d < fields[f].digits; ++d) {
+					int c = FlowSerialTimedRead();
+					if (c < 0) return;
+					sum += c - '0';
+					value = (value << 6) | ((c - '0') & 0x3F);
+				}
+			}
+
+			// Little endian like the binary frame
+			for (uint8_t b = 0; b < fields[f].bytes; ++b) {
+				frame[pos++] = value & 0xFF;
+				value >>= 8;
+			}
+		}
+
+		int checksum = FlowSerialTimedRead();
+		FlowSerialReadIntUntil('\n');
+
+		if (checksum < 0 || ((checksum - '0') & 0x3F) != (sum & 0x3F)) {
+			return;
+		}
+
+		uint8_t frameChecksum = 0;
+		for (uint8_t i = 1; i < SERIAL_FRAME_LENGTH - 1; ++i) {
+			frameChecksum += frame[i];
+		}
+		frame[SERIAL_FRAME_LENGTH - 1] = frameChecksum;
+
+		serialParseFrame(frame);
+	}
+
 public:
 	void setup() {
 	}
 
 	void read() {
-		s_input.speed = FlowSerialReadStringUntil(';').toInt() * 10;
-		s_input.rpm = FlowSerialReadStringUntil(';').toInt();
-		s_input.oil_temp = FlowSerialReadStringUntil(';').toInt();
-		s_input.fuel = FlowSerialReadStringUntil(';').toInt();
-		
-		String gearStr = FlowSerialReadStringUntil(';');
-		if (gearStr == "N") {
-			s_input.explicitGear = NONE;
-			s_input.currentGear = NEUTRAL;
-		} else if (gearStr == "R") {
-			s_input.explicitGear = NONE;
-			s_input.currentGear = REVERSE;
-		} else {
-			int gear = gearStr.toInt();
-			s_input.explicitGear = (GEAR_MANUAL)(min(gear, NUMBER_OF_GEARS));
-			s_input.currentGear = DRIVE;
+		if (FlowSerialTimedPeek() == SH_COMPACT_MARKER) {
+			FlowSerialTimedRead();
+			readCompact();
+			return;
 		}
-		s_input.mode = NORMAL;
 
-		s_input.water_temp = FlowSerialReadStringUntil(';').toInt();
-		s_input.ignition = (IGNITION_STATE)FlowSerialReadStringUntil(';').toInt();
-		s_input.light_lowbeam = s_input.ignition != IG_OFF;
-		s_input.engine_running = FlowSerialReadStringUntil(';').toInt() != 0;
-		
+		// The whole update is read before any of it is stored: the CAN frames are built from the
+		// ARQ idle hook while the rest of the update is still arriving
+		uint16_t speed = FlowSerialReadIntUntil(';') * 10;
+		uint16_t rpm = FlowSerialReadIntUntil(';');
+		uint8_t oil_temp = FlowSerialReadIntUntil(';');
+		uint16_t fuel = FlowSerialReadIntUntil(';');
+
+		GEAR currentGear;
+		GEAR_MANUAL explicitGear;
+		readGear(currentGear, explicitGear);
+
+		uint8_t water_temp = FlowSerialReadIntUntil(';');
+		IGNITION_STATE ignition = (IGNITION_STATE)FlowSerialReadIntUntil(';');
+		bool engine_running = FlowSerialReadIntUntil(';') != 0;
+
 		// Indicators: 0=off, 1=left, 2=right, 3=hazard
-		uint8_t indicators = FlowSerialReadStringUntil(';').toInt();
-		s_input.indicator_state = (INDICATOR)indicators;
-		
-		s_input.handbrake = FlowSerialReadStringUntil(';').toInt() != 0;
-		s_input.abs_warn = FlowSerialReadStringUntil(';').toInt() != 0;
-		s_input.light_tc_active = FlowSerialReadStringUntil(';').toInt() != 0;
-		s_input.fuel_injection = FlowSerialReadStringUntil(';').toInt();
-
-		s_input.time_year   = FlowSerialReadStringUntil(';').toInt();
-		s_input.time_month  = FlowSerialReadStringUntil(';').toInt();
-		s_input.time_day    = FlowSerialReadStringUntil(';').toInt();
-		s_input.time_hour   = FlowSerialReadStringUntil(';').toInt();
-		s_input.time_minute = FlowSerialReadStringUntil(';').toInt();
-		s_input.time_second = FlowSerialReadStringUntil('\n').toInt();
+		INDICATOR indicators = (INDICATOR)FlowSerialReadIntUntil(';');
+
+		bool handbrake = FlowSerialReadIntUntil(';') != 0;
+		bool abs_warn = FlowSerialReadIntUntil(';') != 0;
+		bool tc_active = FlowSerialReadIntUntil(';') != 0;
+		uint16_t fuel_injection = FlowSerialReadIntUntil(';');
+
+		uint16_t time_year = FlowSerialReadIntUntil(';');
+		uint8_t time_month = FlowSerialReadIntUntil(';');
+		uint8_t time_day = FlowSerialReadIntUntil(';');
+		uint8_t time_hour = FlowSerialReadIntUntil(';');
+		uint8_t time_minute = FlowSerialReadIntUntil(';');
+		uint8_t time_second = FlowSerialReadIntUntil('\n');
+
+		s_input.set(s_input.speed, speed, IN_SPEED);
+		s_input.set(s_input.rpm, rpm, IN_RPM);
+		s_input.set(s_input.oil_temp, oil_temp, IN_TEMPS);
+		s_input.set(s_input.fuel, fuel, IN_FUEL);
+
+		s_input.set(s_input.explicitGear, explicitGear, IN_GEAR);
+		s_input.set(s_input.currentGear, currentGear, IN_GEAR);
+		s_input.set(s_input.mode, NORMAL, IN_GEAR);
+
+		s_input.set(s_input.water_temp, water_temp, IN_TEMPS);
+		s_input.set(s_input.ignition, ignition, IN_IGNITION);
+		s_input.set(s_input.light_lowbeam, ignition != IG_OFF, IN_LIGHTS);
+		s_input.set(s_input.engine_running, engine_running, IN_IGNITION);
+		s_input.set(s_input.indicator_state, indicators, IN_INDICATOR);
+
+		s_input.set(s_input.handbrake, handbrake, IN_HANDBRAKE);
+		s_input.set(s_input.abs_warn, abs_warn, IN_WARNINGS);
+		s_input.set(s_input.light_tc_active, tc_active, IN_ASSISTS);
+		s_input.set(s_input.fuel_injection, fuel_injection, IN_FUEL_INJECTION);
+
+		s_input.set(s_input.time_year,   time_year,   IN_TIME);
+		s_input.set(s_input.time_month,  time_month,  IN_TIME);
+		s_input.set(s_input.time_day,    time_day,    IN_TIME);
+		s_input.set(s_input.time_hour,   time_hour,   IN_TIME);
+		s_input.set(s_input.time_minute, time_minute, IN_TIME);
+		s_input.set(s_input.time_second, time_second, IN_TIME);
 	}
 
 	void loop() {
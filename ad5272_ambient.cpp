@@ -7,7 +7,78 @@
 #define NTC_T0    298.15f   // 25C in Kelvin
 #define NTC_BETA  3950.0f
 
-AD5272Ambient::AD5272Ambient() : _address(AD5272_I2C_ADDRESS), _initialized(false) {
+/*
+    Wiper position for every 0.1 °C of the supported range, computed by the
+    compiler so the firmware needs neither expf nor float math. The AD5272-100
+    is 100 kOhm full scale, colder than about -30 °C the NTC is above that and
+    the wiper stays at the end.
+*/
+namespace {
+
+// exp() for constant expressions: halve the argument until the series converges fast, then square back
+constexpr double expSeries(double x, int n = 1, double term = 1.0, double sum = 1.0) {
+    return n > 10 ? sum : expSeries(x, n + 1, term * x / n, sum + term * x / n);
+}
+
+constexpr double square(double v) {
+    return v * v;
+}
+
+constexpr double constExp(double x) {
+    return (x > 0.5 || x < -0.5) ? square(constExp(x / 2)) : expSeries(x);
+}
+
+constexpr double celsiusToResistance(double celsius) {
+    return NTC_R0 * constExp(NTC_BETA * ((1.0 / (celsius + 273.15)) - (1.0 / NTC_T0))) / 1000.0;
+}
+
+constexpr uint16_t resistanceToWiperPosition(double resistance_kohm) {
+    return resistance_kohm >= 100.0 ? AD5272_MAX_POSITION
+                                    : (uint16_t)(resistance_kohm / 100.0 * AD5272_MAX_POSITION);
+}
+
+constexpr uint16_t wiperPosition(int16_t temp) {
+    return resistanceToWiperPosition(celsiusToResistance(temp / 10.0));
+}
+
+// Index sequence built in halves, a linear one would exceed the template depth for 1201 entries
+template <unsigned... I> struct Indices {};
+
+template <typename A, typename B> struct JoinIndices;
+template <unsigned... A, unsigned... B>
+struct JoinIndices<Indices<A...>, Indices<B...>> {
+    typedef Indices<A..., (sizeof...(A) + B)...> type;
+};
+
+template <unsigned N>
+struct MakeIndices : JoinIndices<typename MakeIndices<N / 2>::type, typename MakeIndices<N - N / 2>::type> {};
+template <> struct MakeIndices<0> { typedef Indices<> type; };
+template <> struct MakeIndices<1> { typedef Indices<0> type; };
+
+const unsigned WIPER_TABLE_SIZE = AD5272_MAX_TEMP - AD5272_MIN_TEMP + 1;
+
+template <typename Seq> struct WiperTable;
+template <unsigned... I>
+struct WiperTable<Indices<I...>> {
+    static const uint16_t positions[sizeof...(I)];
+};
+
+template <unsigned... I>
+const uint16_t WiperTable<Indices<I...>>::positions[sizeof...(I)] PROGMEM = {
+    wiperPosition(AD5272_MIN_TEMP + (int16_t)I)...
+};
+
+typedef WiperTable<MakeIndices<WIPER_TABLE_SIZE>::type> Wiper;
+
+static_assert(wiperPosition(AD5272_MIN_TEMP) == AD5272_MAX_POSITION, "Coldest entry must be full scale");
+static_assert(wiperPosition(AD5272_MAX_TEMP) < wiperPosition(AD5272_MAX_TEMP - 100), "Table must fall with temperature");
+
+} // namespace
+
+AD5272Ambient::AD5272Ambient()
+    : _address(AD5272_I2C_ADDRESS), _initialized(false),
+      _wiper_target(AD5272_MAX_POSITION + 1), _wiper_written(AD5272_MAX_POSITION + 1),
+      _wait_start(0), _wait_ms(0) {
 }
 
 bool AD5272Ambient::begin(uint8_t i2c_address) {
@@ -17,6 +88,11 @@ bool AD5272Ambient::begin(uint8_t i2c_address) {
     pinMode(AD5272_I2C_SCL_PIN, INPUT_PULLUP);
 
     Wire.begin();
+    Wire.setClock(AD5272_I2C_CLOCK);
+#if defined(WIRE_HAS_TIMEOUT)
+    // A stuck bus must not hang the loop and with it the CAN frames
+    Wire.setWireTimeout(1000, true);
+#endif
 
     uint16_t control = readRegister(AD5272_CMD_READ_CONTROL);
     if (control == 0xFFFF) {
@@ -34,93 +110,102 @@ bool AD5272Ambient::begin(uint8_t i2c_address) {
     return true;
 }
 
-bool AD5272Ambient::setTemperature(float celsius) {
-    if (!_initialized) {
-        return false;
+// Runs at most one I2C write per call
+void AD5272Ambient::service(uint32_t now_ms) {
+    if (!_initialized || now_ms - _wait_start < _wait_ms) {
+        return;
     }
 
-    celsius = constrain(celsius, -40.0, 80.0);
-    float resistance = celsiusToResistance(celsius);
-    uint16_t position = resistanceToWiperPosition(resistance);
+    Command next;
+    if (_queue.pop(next)) {
+        if (!writeCommand(next.command, next.data)) {
+            // The rest of a sequence makes no sense without this step
+            _queue.clear();
+            _wait_start = now_ms;
+            _wait_ms = AD5272_RETRY_MS;
+            return;
+        }
+        if (next.command == AD5272_CMD_WRITE_RDAC) {
+            _wiper_written = next.data;
+        }
+        _wait_start = now_ms;
+        _wait_ms = next.settle_ms;
+        return;
+    }
 
-    return setWiperPosition(position);
+    if (_wiper_target != _wiper_written) {
+        if (writeCommand(AD5272_CMD_WRITE_RDAC, _wiper_target)) {
+            _wiper_written = _wiper_target;
+        } else {
+            _wait_start = now_ms;
+            _wait_ms = AD5272_RETRY_MS;
+        }
+    }
+}
+
+bool AD5272Ambient::isIdle() {
+    return _queue.isEmpty() && _wiper_target == _wiper_written;
 }
 
-bool AD5272Ambient::storeStartupTemperature(float celsius) {
+bool AD5272Ambient::setTemperature(int16_t temp) {
     if (!_initialized) {
         return false;
     }
 
-    // Enable RDAC writing first (bit 1)
-    if (!writeCommand(AD5272_CMD_WRITE_CONTROL, AD5272_CONTROL_RDAC_WRITE_ENABLE)) {
-        return false;
-    }
+    temp = constrain(temp, AD5272_MIN_TEMP, AD5272_MAX_TEMP);
+    uint16_t position = pgm_read_word(&Wiper::positions[temp - AD5272_MIN_TEMP]);
 
-    delay(5);
+    return setWiperPosition(position);
+}
 
-    // Now set the wiper position
-    if (!setTemperature(celsius)) {
+bool AD5272Ambient::storeStartupTemperature(int16_t temp) {
+    if (!_initialized || _queue.capacity() - _queue.size() < 5) {
         return false;
     }
 
-    delay(10);  // Ensure RDAC write completes
+    temp = constrain(temp, AD5272_MIN_TEMP, AD5272_MAX_TEMP);
+    uint16_t position = pgm_read_word(&Wiper::positions[temp - AD5272_MIN_TEMP]);
+    _wiper_target = position;
 
-    // Enable 50-TP (EEPROM) writing while keeping RDAC enabled
-    uint8_t control_value = AD5272_CONTROL_50TP_ENABLE | AD5272_CONTROL_RDAC_WRITE_ENABLE;
-    if (!writeCommand(AD5272_CMD_WRITE_CONTROL, control_value)) {
-        return false;
-    }
+    // Enable RDAC writing first (bit 1)
+    queueCommand(AD5272_CMD_WRITE_CONTROL, AD5272_CONTROL_RDAC_WRITE_ENABLE, 5);
 
-    delay(10);
+    // Now set the wiper position and let the write complete
+    queueCommand(AD5272_CMD_WRITE_RDAC, position, 10);
 
-    // Store current wiper position to EEPROM (50 write limit!)
-    if (!writeCommand(AD5272_CMD_STORE_WIPER, 0x00)) {
-        return false;
-    }
+    // Enable 50-TP (EEPROM) writing while keeping RDAC enabled
+    queueCommand(AD5272_CMD_WRITE_CONTROL, AD5272_CONTROL_50TP_ENABLE | AD5272_CONTROL_RDAC_WRITE_ENABLE, 10);
 
-    // Allow time for EEPROM write to complete
-    delay(350);
+    // Store current wiper position to EEPROM (50 write limit!), the write takes up to 350 ms
+    queueCommand(AD5272_CMD_STORE_WIPER, 0x00, 350);
 
     // Re-lock 50-TP (clear bit 0, keep bit 1)
-    writeCommand(AD5272_CMD_WRITE_CONTROL, AD5272_CONTROL_RDAC_WRITE_ENABLE);
+    queueCommand(AD5272_CMD_WRITE_CONTROL, AD5272_CONTROL_RDAC_WRITE_ENABLE, 0);
 
     return true;
 }
 
-float AD5272Ambient::celsiusToResistance(float celsius) {
-    float temp_k = celsius + 273.15f;
-    float resistance_ohms = NTC_R0 * expf(
-        NTC_BETA * ((1.0f / temp_k) - (1.0f / NTC_T0))
-    );
-    return resistance_ohms / 1000.0f;
-}
-
-uint16_t AD5272Ambient::resistanceToWiperPosition(float resistance_kohm) {
-    float position_normalized = resistance_kohm / 100.0;
-    position_normalized = constrain(position_normalized, 0.0, 1.0);
-
-    uint16_t position = (uint16_t)(position_normalized * AD5272_MAX_POSITION);
-
-    return position;
-}
-
 bool AD5272Ambient::setWiperPosition(uint16_t position) {
     if (!_initialized) {
         return false;
     }
 
-    position = min(position, AD5272_MAX_POSITION);
+    _wiper_target = min(position, AD5272_MAX_POSITION);
+    return true;
+}
 
-    return writeCommand(AD5272_CMD_WRITE_RDAC, position);
+bool AD5272Ambient::queueCommand(uint8_t command, uint16_t data, uint16_t settle_ms) {
+    Command entry = {command, data, settle_ms};
+    return _queue.push(entry);
 }
 
+// Last position written, without a bus transaction
 uint16_t AD5272Ambient::getWiperPosition() {
-    if (!_initialized) {
+    if (!_initialized || _wiper_written > AD5272_MAX_POSITION) {
         return 0;
     }
 
-    uint16_t raw = readRegister(AD5272_CMD_READ_RDAC);
-    return raw & 0x03FF;
+    return _wiper_written;
 }
 
 uint16_t AD5272Ambient::readEEPROM() {
@@ -6,6 +6,7 @@
 #if defined(USE_AD5272_AMBIENT)
 
 #include <Wire.h>
+#include "spsc_ring.h"
 
 #define AD5272_CMD_WRITE_RDAC       (1 << 2)
 #define AD5272_CMD_READ_RDAC        (2 << 2)
@@ -23,24 +24,54 @@
 
 #define AD5272_MAX_POSITION 1023
 
+// Supported ambient range in 0.1 °C, the unit of s_input.ambient_temp
+#define AD5272_MIN_TEMP -400
+#define AD5272_MAX_TEMP 800
+
+#define AD5272_I2C_CLOCK      400000  // Fast mode, a command is then ~70 us on the bus
+#define AD5272_QUEUE_SIZE     8
+#define AD5272_RETRY_MS       100     // Pause after a failed write, e.g. when the chip is missing
+
+/*
+    Writes are queued and run one per service() call from the main loop, so a
+    caller never waits for the bus and the settling times the chip needs after
+    some commands are timestamps instead of delay(). The wiper is written only
+    when the wanted position differs from the last one written, repeated
+    setTemperature() calls with the same value cost nothing.
+
+    begin() and the read functions are still blocking, they are meant for setup
+    and diagnostics.
+*/
 class AD5272Ambient {
 public:
     AD5272Ambient();
 
     bool begin(uint8_t i2c_address = AD5272_I2C_ADDRESS);
-    bool setTemperature(float celsius);
-    bool storeStartupTemperature(float celsius);
+    void service(uint32_t now_ms);
+    bool setTemperature(int16_t temp);
+    bool storeStartupTemperature(int16_t temp);
+    bool setWiperPosition(uint16_t position);
     uint16_t getWiperPosition();
     uint16_t readEEPROM();
     uint16_t readControlRegister();
-    bool setWiperPosition(uint16_t position);
+    bool isIdle();
 
 private:
+    struct Command {
+        uint8_t command;
+        uint16_t data;
+        uint16_t settle_ms;  // Time the chip needs before the next command
+    };
+
     uint8_t _address;
     bool _initialized;
+    SpscRing<Command, AD5272_QUEUE_SIZE> _queue;
+    uint16_t _wiper_target;
+    uint16_t _wiper_written;
+    uint32_t _wait_start;
+    uint16_t _wait_ms;
 
-    float celsiusToResistance(float celsius);
-    uint16_t resistanceToWiperPosition(float resistance_kohm);
+    bool queueCommand(uint8_t command, uint16_t data, uint16_t settle_ms);
     bool writeCommand(uint8_t command, uint16_t data);
     uint16_t readRegister(uint8_t command);
 };
@@ -3,9 +3,6 @@
 #include <stdint.h>
 #include <stddef.h>
 
-void canBegin();
-void canSend(uint32_t id, const uint8_t* data);
-
 typedef void (*CanFrameHandler)(const uint8_t* data);
 
 struct CanHandlerEntry {
@@ -13,4 +10,22 @@ struct CanHandlerEntry {
     CanFrameHandler handler;
 };
 
-void canPoll(const CanHandlerEntry* handlers, size_t count);
+// Returns false if no handler exists for the ID, see can_dispatch.h
+typedef bool (*CanFrameDispatch)(uint32_t id, const uint8_t* data);
+
+// The handler IDs are used to set up hardware acceptance filters where the adapter has them
+void canBegin(const CanHandlerEntry* handlers, size_t count);
+// Sends len (0-8) bytes, use the DLC the real car uses for the ID to keep the bus load down
+void canSend(uint32_t id, const uint8_t* data, uint8_t len = 8);
+void canPoll(CanFrameDispatch dispatch);
+
+// Standard ID bits that are equal in all of the handler IDs, for single mask acceptance filters
+inline uint32_t canCommonIdMask(const CanHandlerEntry* handlers, size_t count) {
+    uint32_t all_set = 0x7FF;
+    uint32_t any_set = 0;
+    for (size_t i = 0; i < count; ++i) {
+        all_set &= handlers[i].id;
+        any_set |= handlers[i].id;
+    }
+    return ~(all_set ^ any_set) & 0x7FF;
+}
@@ -7,34 +7,67 @@
 #include <mcp_can.h>
 #include "can_adapter.h"
 #include "serial.h"
+#include "can_stats.h"
 
 static MCP_CAN CAN(MCP_CAN_SPI_CS_PIN);
 
-void canBegin() {
+// In MCP_STDEXT mode the standard ID is in bits 16-26 of the masks and filters,
+// the lower bits would match the first two data bytes
+static void canSetFilters(const CanHandlerEntry* handlers, size_t count) {
+    const uint8_t FILTER_COUNT = 6;
+
+    if (count == 0) {
+        return;
+    }
+
+    // Exact match per ID when they fit the filters, otherwise only the common bits
+    uint32_t mask = count <= FILTER_COUNT ? 0x7FF : canCommonIdMask(handlers, count);
+    CAN.init_Mask(0, 0, mask << 16);
+    CAN.init_Mask(1, 0, mask << 16);
+
+    for (uint8_t i = 0; i < FILTER_COUNT; ++i) {
+        // Unused filters repeat the last ID
+        uint32_t id = handlers[i < count ? i : count - 1].id;
+        CAN.init_Filt(i, 0, id << 16);
+    }
+}
+
+void canBegin(const CanHandlerEntry* handlers, size_t count) {
     randomSeed(analogRead(A0));
     while (CAN_OK != CAN.begin(MCP_STDEXT, CAN_100KBPS, MCP_CAN_SPI_SPEED)) {
         pc.println("CAN BUS init fail, retrying...");
         delay(100);
     }
+#if defined(USE_CAN_STATS)
+    // The bus load needs every frame, begin() leaves the masks open
+    (void)handlers;
+    (void)count;
+#else
+    canSetFilters(handlers, count);
+#endif
     CAN.setMode(MCP_NORMAL);
 }
 
-void canSend(uint32_t id, const uint8_t* data) {
-    CAN.sendMsgBuf(id, 0, 8, (byte*)data);
+void canSend(uint32_t id, const uint8_t* data, uint8_t len) {
+#if defined(USE_CAN_STATS)
+    if (CAN.sendMsgBuf(id, 0, len, (byte*)data) == CAN_OK) {
+        canStatsRecord(id, data, len, CAN_STATS_TX);
+    }
+#else
+    CAN.sendMsgBuf(id, 0, len, (byte*)data);
+#endif
 }
 
-void canPoll(const CanHandlerEntry* handlers, size_t count) {
+void canPoll(CanFrameDispatch dispatch) {
     unsigned long id;
     uint8_t len;
     uint8_t buf[8];
     while (CAN_MSGAVAIL == CAN.checkReceive()) {
         CAN.readMsgBuf(&id, &len, buf);
-        for (size_t i = 0; i < count; ++i) {
-            if (id == handlers[i].id) {
-                handlers[i].handler(buf);
-                break;
-            }
-        }
+#if defined(USE_CAN_STATS)
+        canStatsRecord(id, buf, len, CAN_STATS_RX);
+#endif
+        dispatch(id, buf);
     }
 }
 
@@ -5,6 +5,8 @@
 #include <Arduino.h>
 #include <string.h>
 #include "can_adapter.h"
+#include "can_stats.h"
+#include "can_timer.h"
 
 // Longan Serial CAN bus adapter: https://docs.longan-labs.cc/1030001/
 #define canSerial Serial1
@@ -12,7 +14,8 @@
 #define FRAME_SIZE 14
 static uint8_t buffer[FRAME_SIZE];
 
-void canBegin() {
+// The adapter's own filters live in its persistent configuration so all IDs are received
+void canBegin(const CanHandlerEntry* /*handlers*/, size_t /*count*/) {
     canSerial.begin(CAN_SERIAL_BAUD);
 
 #if defined(__AVR_AT90USB1286__)
@@ -23,37 +26,60 @@ void canBegin() {
 #endif
 }
 
-void canSend(uint32_t id, const uint8_t* data) {
+// The adapter protocol has no length field and always sends 8 bytes on the bus,
+// bytes past len are sent as zero
+static bool canWrite(uint32_t id, const uint8_t* data, uint8_t len) {
     uint8_t buf[FRAME_SIZE] = {
         (uint8_t)((id >> 24) & 0xFF), (uint8_t)((id >> 16) & 0xFF),
         (uint8_t)((id >> 8) & 0xFF), (uint8_t)(id & 0xFF),
         0x00, 0x00
     };
-    memcpy(&buf[6], data, 8);
-    canSerial.write(buf, FRAME_SIZE);
+    memcpy(&buf[6], data, len);
+    return canSerial.write(buf, FRAME_SIZE) == FRAME_SIZE;
 }
 
-static bool match_id(const uint8_t* buf, uint32_t id) {
-    return
-        buf[0] == ((id >> 24) & 0xFF) &&
-        buf[1] == ((id >> 16) & 0xFF) &&
-        buf[2] == ((id >> 8) & 0xFF) &&
-        buf[3] == (id & 0xFF);
+#if defined(USE_CAN_TIMER_TX)
+// Queued padded like the bus frame, the timer counts it once it is sent
+void canSend(uint32_t id, const uint8_t* data, uint8_t len) {
+    uint8_t padded[8] = {0};
+    memcpy(padded, data, len);
+    canTimerQueue(id, padded, 8);
 }
 
-void canPoll(const CanHandlerEntry* handlers, size_t count) {
+// From the timer, one frame fits the serial TX buffer so the write does not wait
+bool canTransmit(const CanTxFrame& frame) {
+    return canWrite(frame.id, frame.data, frame.len);
+}
+#else
+void canSend(uint32_t id, const uint8_t* data, uint8_t len) {
+    if (!canWrite(id, data, len)) {
+        return;
+    }
+#if defined(USE_CAN_STATS)
+    uint8_t padded[8] = {0};
+    memcpy(padded, data, len);
+    canStatsRecord(id, padded, 8, CAN_STATS_TX);
+#endif
+}
+#endif
+
+void canPoll(CanFrameDispatch dispatch) {
     while (canSerial.available()) {
         for (int i = 0; i < FRAME_SIZE - 1; ++i) {
             buffer[i] = buffer[i + 1];
         }
         buffer[FRAME_SIZE - 1] = canSerial.read();
 
-        for (size_t i = 0; i < count; ++i) {
-            if (match_id(buffer, handlers[i].id)) {
-                handlers[i].handler(buffer + 4);
-                break;
-            }
+        uint32_t id = ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) |
+                      ((uint32_t)buffer[2] << 8) | buffer[3];
+        // The byte stream has no frame boundaries, so only frames that matched a handler are counted
+#if defined(USE_CAN_STATS)
+        if (dispatch(id, buffer + 4)) {
+            canStatsRecord(id, buffer + 4, 8, CAN_STATS_RX);
         }
+#else
+        dispatch(id, buffer + 4);
+#endif
     }
 }
 
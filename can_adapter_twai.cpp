@@ -7,8 +7,10 @@
 #include "driver/twai.h"
 #include "can_adapter.h"
 #include "serial.h"
+#include "can_stats.h"
+#include "can_timer.h"
 
-void canBegin() {
+void canBegin(const CanHandlerEntry* handlers, size_t count) {
     twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(
         (gpio_num_t)TWAI_TX_PIN,
         (gpio_num_t)TWAI_RX_PIN,
@@ -17,6 +19,20 @@ void canBegin() {
     twai_timing_config_t t_config = TWAI_TIMING_CONFIG_100KBITS();
     twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
 
+#if defined(USE_CAN_STATS)
+    // The bus load needs every frame
+    (void)handlers;
+    (void)count;
+#else
+    if (count) {
+        // Single filter on the ID bits shared by all handled IDs. In single filter mode
+        // the standard ID is in bits 21-31 and a set mask bit means "don't care"
+        f_config.acceptance_code = handlers[0].id << 21;
+        f_config.acceptance_mask = ~(canCommonIdMask(handlers, count) << 21);
+        f_config.single_filter = true;
+    }
+#endif
+
     while (twai_driver_install(&g_config, &t_config, &f_config) != ESP_OK
            || twai_start() != ESP_OK) {
         pc.println("CAN BUS init fail, retrying...");
@@ -26,23 +42,41 @@ void canBegin() {
     }
 }
 
-void canSend(uint32_t id, const uint8_t* data) {
+#if defined(USE_CAN_TIMER_TX)
+// The timer counts the frame once it is sent
+void canSend(uint32_t id, const uint8_t* data, uint8_t len) {
+    canTimerQueue(id, data, len);
+}
+
+// From the esp_timer task, which must not block
+bool canTransmit(const CanTxFrame& frame) {
+    twai_message_t msg = {};
+    msg.identifier = frame.id;
+    msg.data_length_code = frame.len;
+    memcpy(msg.data, frame.data, frame.len);
+    return twai_transmit(&msg, 0) == ESP_OK;
+}
+#else
+void canSend(uint32_t id, const uint8_t* data, uint8_t len) {
     twai_message_t msg = {};
     msg.identifier = id;
-    msg.data_length_code = 8;
-    memcpy(msg.data, data, 8);
-    twai_transmit(&msg, pdMS_TO_TICKS(2));
+    msg.data_length_code = len;
+    memcpy(msg.data, data, len);
+    if (twai_transmit(&msg, pdMS_TO_TICKS(2)) == ESP_OK) {
+#if defined(USE_CAN_STATS)
+        canStatsRecord(id, data, len, CAN_STATS_TX);
+#endif
+    }
 }
+#endif
 
-void canPoll(const CanHandlerEntry* handlers, size_t count) {
+void canPoll(CanFrameDispatch dispatch) {
     twai_message_t msg;
     while (twai_receive(&msg, 0) == ESP_OK) {
-        for (size_t i = 0; i < count; ++i) {
-            if (msg.identifier == handlers[i].id) {
-                handlers[i].handler(msg.data);
-                break;
-            }
-        }
+#if defined(USE_CAN_STATS)
+        canStatsRecord(msg.identifier, msg.data, msg.data_length_code, CAN_STATS_RX);
+#endif
+        dispatch(msg.identifier, msg.data);
     }
 }
 
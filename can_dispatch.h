@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "can_adapter.h"
+
+/*
+    Compile-time CAN RX dispatch.
+
+    The handler table is searched at compile time for a hash that puts every ID
+    into a bucket of its own in a small power-of-two table. A received frame is
+    then matched or rejected with one hash, one load and one compare no matter
+    how many IDs are handled.
+
+    Usage:
+        static constexpr CanHandlerEntry table[] = { { 0x330, handle330 }, ... };
+        typedef CanRxTable<table, sizeof(table) / sizeof(table[0])> CanRx;
+        canPoll(CanRx::dispatch);
+*/
+
+namespace can_dispatch {
+
+// Bucket of an ID, the shift is picked per table so that no two IDs share a bucket
+constexpr uint8_t bucketOf(uint32_t id, uint8_t shift, size_t buckets) {
+    return (uint8_t)((id ^ (id >> shift)) & (buckets - 1));
+}
+
+constexpr bool collides(const CanHandlerEntry* t, size_t n, uint8_t shift, size_t buckets, size_t i, size_t j) {
+    return j >= n ? false
+        : bucketOf(t[i].id, shift, buckets) == bucketOf(t[j].id, shift, buckets)
+          || collides(t, n, shift, buckets, i, j + 1);
+}
+
+constexpr bool isPerfect(const CanHandlerEntry* t, size_t n, uint8_t shift, size_t buckets, size_t i = 0) {
+    return i >= n ? true
+        : !collides(t, n, shift, buckets, i, i + 1) && isPerfect(t, n, shift, buckets, i + 1);
+}
+
+constexpr size_t pow2AtLeast(size_t n, size_t p = 1) {
+    return p >= n ? p : pow2AtLeast(n, p * 2);
+}
+
+// Returns (buckets << 4) | shift for the smallest table that works, 0 if none does
+constexpr uint16_t search(const CanHandlerEntry* t, size_t n, size_t buckets, uint8_t shift = 1) {
+    return buckets > 256 ? 0
+        : shift > 11 ? search(t, n, buckets * 2)
+        : isPerfect(t, n, shift, buckets) ? (uint16_t)((buckets << 4) | shift)
+        : search(t, n, buckets, shift + 1);
+}
+
+constexpr uint8_t slotFor(const CanHandlerEntry* t, size_t n, uint8_t shift, size_t buckets, size_t bucket, size_t i = 0) {
+    return i >= n ? 0xFF
+        : bucketOf(t[i].id, shift, buckets) == bucket ? (uint8_t)i
+        : slotFor(t, n, shift, buckets, bucket, i + 1);
+}
+
+template <size_t... I> struct Seq {};
+template <size_t N, size_t... I> struct MakeSeq : MakeSeq<N - 1, N - 1, I...> {};
+template <size_t... I> struct MakeSeq<0, I...> { typedef Seq<I...> type; };
+
+template <const CanHandlerEntry* Table, size_t Count, uint8_t Shift, typename S> struct Buckets;
+
+template <const CanHandlerEntry* Table, size_t Count, uint8_t Shift, size_t... B>
+struct Buckets<Table, Count, Shift, Seq<B...> > {
+    static const uint8_t slot[sizeof...(B)];
+};
+
+template <const CanHandlerEntry* Table, size_t Count, uint8_t Shift, size_t... B>
+const uint8_t Buckets<Table, Count, Shift, Seq<B...> >::slot[sizeof...(B)] = {
+    slotFor(Table, Count, Shift, sizeof...(B), B)...
+};
+
+} // namespace can_dispatch
+
+template <const CanHandlerEntry* Table, size_t Count>
+class CanRxTable {
+    static_assert(Count > 0 && Count < 0xFF, "CAN RX table must have 1-254 entries");
+
+    static constexpr uint16_t PARAMS = can_dispatch::search(Table, Count, can_dispatch::pow2AtLeast(Count));
+    static_assert(PARAMS != 0, "No collision free hash found for the CAN RX IDs, are there duplicates?");
+
+    static constexpr uint8_t SHIFT = PARAMS & 0x0F;
+    static constexpr size_t BUCKETS = PARAMS >> 4;
+
+    typedef can_dispatch::Buckets<Table, Count, SHIFT, typename can_dispatch::MakeSeq<BUCKETS>::type> Lookup;
+
+public:
+    // Calls the handler for the ID and returns true, or returns false for an unknown ID
+    static bool dispatch(uint32_t id, const uint8_t* data) {
+        const uint8_t slot = Lookup::slot[can_dispatch::bucketOf(id, SHIFT, BUCKETS)];
+        if (slot == 0xFF || Table[slot].id != id) {
+            return false;
+        }
+        Table[slot].handler(data);
+        return true;
+    }
+};
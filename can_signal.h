@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+    Compile-time CAN signal layouts.
+
+    A signal is described by its start bit and length in Intel (little endian)
+    bit numbering, as used in DBC files: bit 0 is the LSB of byte 0 and a signal
+    continues into the following bytes. The byte, shift and mask of every part
+    are template constants, so put() and get() unroll to the same one or two
+    masked byte operations per byte that the hand-written shifts did and a full
+    byte is a plain store.
+
+    Usage:
+        typedef CanSignal<0, 12> VehicleSpeed;           // 0.1 km/h
+        typedef CanSignal<32, 16, 1, 4> EngineSpeed;     // raw = rpm * 4
+        typedef CanCounter<52, 4> Alive;
+        typedef CanXorChecksum<7> Checksum;
+
+        VehicleSpeed::put(frame, s_input.speed);
+        EngineSpeed::encode(frame, s_input.rpm);
+        Checksum::put(frame);
+        canSend(ID, frame);
+        Alive::next(frame);
+*/
+
+template <bool Small> struct CanRawType { typedef uint32_t type; };
+template <> struct CanRawType<true> { typedef uint16_t type; };
+
+template <uint8_t Start, uint8_t Length>
+struct CanBits {
+    static_assert(Length >= 1 && Length <= 32, "CAN signal must be 1-32 bits");
+    static_assert(Start + Length <= 64, "CAN signal must fit in 8 bytes");
+
+    typedef typename CanRawType<(Length <= 16)>::type raw_t;
+
+    static constexpr uint8_t START = Start;
+    static constexpr uint8_t LENGTH = Length;
+
+    // Part of the signal in the first byte it touches
+    static constexpr uint8_t BYTE = Start / 8;
+    static constexpr uint8_t SHIFT = Start % 8;
+    static constexpr uint8_t WIDTH = 8 - SHIFT < Length ? 8 - SHIFT : Length;
+    static constexpr uint8_t MASK = (uint8_t)(((1u << WIDTH) - 1) << SHIFT);
+
+    typedef CanBits<Start + WIDTH, Length - WIDTH> Rest;
+
+    // Stores the raw value, the other bits of the frame are left untouched
+    static inline void put(uint8_t* frame, raw_t raw) {
+        if (MASK == 0xFF) {
+            frame[BYTE] = (uint8_t)raw;
+        } else {
+            frame[BYTE] = (frame[BYTE] & (uint8_t)~MASK) | ((uint8_t)(raw << SHIFT) & MASK);
+        }
+        Rest::put(frame, (raw_t)(raw >> WIDTH));
+    }
+
+    static inline raw_t get(const uint8_t* frame) {
+        return (raw_t)((frame[BYTE] & MASK) >> SHIFT) | ((raw_t)Rest::get(frame) << WIDTH);
+    }
+};
+
+template <uint8_t Start>
+struct CanBits<Start, 0> {
+    static inline void put(uint8_t*, uint32_t) {}
+    static inline uint8_t get(const uint8_t*) { return 0; }
+};
+
+// Physical value = raw * Factor / Divisor + Offset
+template <uint8_t Start, uint8_t Length, int32_t Factor = 1, int32_t Divisor = 1, int32_t Offset = 0>
+struct CanSignal : CanBits<Start, Length> {
+    static_assert(Factor != 0 && Divisor > 0, "CAN signal scale must be non-zero");
+
+    typedef typename CanBits<Start, Length>::raw_t raw_t;
+
+    static constexpr int32_t FACTOR = Factor;
+    static constexpr int32_t DIVISOR = Divisor;
+    static constexpr int32_t OFFSET = Offset;
+
+    // Integer values are converted in integer math, floats only when the value is one
+    template <typename T>
+    static inline void encode(uint8_t* frame, T physical) {
+        CanBits<Start, Length>::put(frame, (raw_t)(int32_t)((physical - Offset) * Divisor / Factor));
+    }
+
+    template <typename T>
+    static inline T decode(const uint8_t* frame) {
+        return (T)((T)CanBits<Start, Length>::get(frame) * Factor / Divisor + Offset);
+    }
+};
+
+// Rolling counter, Modulo defaults to the full range of the signal
+template <uint8_t Start, uint8_t Length, uint16_t Modulo = (uint16_t)(1UL << Length)>
+struct CanCounter : CanBits<Start, Length> {
+    static_assert(Length <= 8, "CAN counters are at most one byte");
+
+    // Advances the counter in place, called after the frame is sent
+    static inline void next(uint8_t* frame) {
+        next(frame, Modulo);
+    }
+
+    // For counters whose cycle depends on the frame contents
+    static inline void next(uint8_t* frame, uint16_t modulo) {
+        CanBits<Start, Length>::put(frame, (CanBits<Start, Length>::get(frame) + 1) % modulo);
+    }
+};
+
+// XOR of bytes 0 to Byte - 1 stored in Byte
+template <uint8_t Byte>
+struct CanXorChecksum {
+    static_assert(Byte >= 1 && Byte < 8, "Checksum must follow the bytes it covers");
+
+    static inline void put(uint8_t* frame) {
+        uint8_t checksum = 0x00;
+        for (uint8_t i = 0; i < Byte; ++i) {
+            checksum ^= frame[i];
+        }
+        frame[Byte] = checksum;
+    }
+};
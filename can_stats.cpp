@@ -0,0 +1,170 @@
+#include "can_stats.h"
+
+#if defined(USE_CAN_STATS)
+
+#include <Arduino.h>
+#include "serial.h"
+#include "pc_printf.h"
+#include "can_timer.h"
+
+#define CAN_BITS_PER_MS 100  // 100 kbit/s
+#define CAN_STATS_WINDOW_MS 1000
+
+#if defined(USE_MCP_CAN_SPI) || defined(USE_ESP32_TWAI)
+    #define CAN_STATS_RX_LABEL "RX"
+#else
+    // The serial adapter's byte stream can only be split at the handled IDs
+    #define CAN_STATS_RX_LABEL "RX of handled IDs"
+#endif
+
+struct CanStatsEntry {
+    uint16_t key;            // ID, bit 15 set for RX
+    uint16_t last_ms;        // Wraps but periods are well below a minute
+    uint16_t period_ms;      // Latest interval between frames
+    uint16_t max_period_ms;  // Longest interval within the window
+    uint16_t bits;           // Bits within the window
+};
+
+static CanStatsEntry entries[CAN_STATS_MAX_IDS];
+static uint8_t entry_count = 0;
+static uint32_t window_start_ms = 0;
+static uint32_t window_bits[2] = {0, 0};
+static uint16_t window_frames = 0;
+static uint8_t windows_until_report = CAN_STATS_REPORT_WINDOWS;
+
+struct StuffCounter {
+    uint8_t last = 2;
+    uint8_t run = 0;
+    uint8_t count = 0;
+
+    void feed(uint32_t value, uint8_t bits) {
+        while (bits--) {
+            uint8_t bit = (value >> bits) & 1;
+            if (bit == last) {
+                run++;
+            } else {
+                last = bit;
+                run = 1;
+            }
+            if (run == 5) {
+                // The stuffed complementary bit starts the next run
+                count++;
+                last = !bit;
+                run = 1;
+            }
+        }
+    }
+};
+
+uint8_t canFrameBits(uint32_t id, const uint8_t* data, uint8_t len) {
+    // SOF, 11-bit ID, RTR, IDE, r0, DLC, CRC (15), CRC delimiter, ACK slot and delimiter, EOF (7), IFS (3)
+    const uint8_t FIXED_BITS = 1 + 11 + 3 + 4 + 15 + 1 + 2 + 7 + 3;
+
+    StuffCounter stuff;
+    stuff.feed(0, 1);
+    stuff.feed(id & 0x7FF, 11);
+    stuff.feed(0, 3);
+    stuff.feed(len, 4);
+    for (uint8_t i = 0; i < len; ++i) {
+        stuff.feed(data[i], 8);
+    }
+
+    // The CRC is not known here so assume the worst case for it
+    return FIXED_BITS + len * 8 + stuff.count + 15 / 4;
+}
+
+static CanStatsEntry* findEntry(uint16_t key) {
+    for (uint8_t i = 0; i < entry_count; ++i) {
+        if (entries[i].key == key) {
+            return &entries[i];
+        }
+    }
+    if (entry_count == CAN_STATS_MAX_IDS) {
+        return nullptr;
+    }
+    CanStatsEntry* entry = &entries[entry_count++];
+    entry->key = key;
+    entry->last_ms = (uint16_t)millis();
+    entry->period_ms = 0;
+    entry->max_period_ms = 0;
+    entry->bits = 0;
+    return entry;
+}
+
+void canStatsRecord(uint32_t id, const uint8_t* data, uint8_t len, CAN_STATS_DIRECTION direction) {
+    const uint8_t bits = canFrameBits(id, data, len);
+    window_bits[direction] += bits;
+    window_frames++;
+
+    CanStatsEntry* entry = findEntry((id & 0x7FF) | (direction == CAN_STATS_RX ? 0x8000 : 0));
+    if (!entry) {
+        return;
+    }
+
+    const uint16_t now_ms = (uint16_t)millis();
+    entry->period_ms = now_ms - entry->last_ms;
+    entry->last_ms = now_ms;
+    if (entry->period_ms > entry->max_period_ms) {
+        entry->max_period_ms = entry->period_ms;
+    }
+    entry->bits += bits;
+}
+
+static void report(uint32_t elapsed_ms) {
+    // Permille of the bus capacity
+    const uint32_t tx = window_bits[CAN_STATS_TX] * 10 / elapsed_ms;
+    const uint32_t rx = window_bits[CAN_STATS_RX] * 10 / elapsed_ms;
+
+    serial_printf(pc, "[CANSTAT] Load: %u.%u%% (TX %u.%u%%, " CAN_STATS_RX_LABEL " %u.%u%%), %u frames\n",
+        (unsigned)((tx + rx) / 10), (unsigned)((tx + rx) % 10),
+        (unsigned)(tx / 10), (unsigned)(tx % 10),
+        (unsigned)(rx / 10), (unsigned)(rx % 10),
+        window_frames);
+
+#if defined(USE_CAN_TIMER_TX)
+    serial_printf(pc, "[CANSTAT] Late scheduler ticks: %lu, repeated frames: %lu\n",
+        (unsigned long)canTimerLateTicks(), (unsigned long)canTimerRepeatedFrames());
+#endif
+
+    for (uint8_t i = 0; i < entry_count; ++i) {
+        const CanStatsEntry& e = entries[i];
+        if (!e.bits) {
+            continue;
+        }
+        serial_printf(pc, "[CANSTAT] %s %03X: %u bit/s, period %u ms (max %u ms)\n",
+            (e.key & 0x8000) ? "RX" : "TX", e.key & 0x7FF,
+            (unsigned)((uint32_t)e.bits * 1000 / elapsed_ms),
+            e.period_ms, e.max_period_ms);
+    }
+}
+
+void canStatsUpdate(uint32_t now_ms) {
+#if defined(USE_CAN_TIMER_TX)
+    // Frames are counted once the timer has sent them
+    canTimerRecordStats();
+#endif
+
+    const uint32_t elapsed_ms = now_ms - window_start_ms;
+    if (elapsed_ms < CAN_STATS_WINDOW_MS) {
+        return;
+    }
+
+    // Raw prints would corrupt the SimHub ARQ stream
+#if !defined(USE_SIMHUB)
+    if (--windows_until_report == 0) {
+        windows_until_report = CAN_STATS_REPORT_WINDOWS;
+        report(elapsed_ms);
+    }
+#endif
+
+    window_start_ms = now_ms;
+    window_bits[CAN_STATS_TX] = 0;
+    window_bits[CAN_STATS_RX] = 0;
+    window_frames = 0;
+    for (uint8_t i = 0; i < entry_count; ++i) {
+        entries[i].bits = 0;
+        entries[i].max_period_ms = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "config.h"
+#include <stdint.h>
+
+#if defined(USE_CAN_STATS)
+
+enum CAN_STATS_DIRECTION {
+    CAN_STATS_TX = 0,
+    CAN_STATS_RX = 1
+};
+
+// Bits the frame takes on the wire: fixed fields, data, stuff bits and interframe space
+uint8_t canFrameBits(uint32_t id, const uint8_t* data, uint8_t len);
+
+// Called by the adapters for each frame sent or received
+void canStatsRecord(uint32_t id, const uint8_t* data, uint8_t len, CAN_STATS_DIRECTION direction);
+
+// Closes the measurement window when it is over and periodically reports it to the PC
+void canStatsUpdate(uint32_t now_ms);
+
+#endif
@@ -0,0 +1,247 @@
+#include "can_timer.h"
+
+#if defined(USE_CAN_TIMER_TX)
+
+#include <Arduino.h>
+#include <string.h>
+#include "can_stats.h"
+#include "spsc_ring.h"
+
+#if defined(ESP32)
+// The esp_timer task may run on the other core, so both sides take the lock
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+#define TIMER_LOCK() portENTER_CRITICAL(&lock)
+#define TIMER_UNLOCK() portEXIT_CRITICAL(&lock)
+#define LOOP_LOCK() portENTER_CRITICAL(&lock)
+#define LOOP_UNLOCK() portEXIT_CRITICAL(&lock)
+#else
+// The timer is an interrupt the loop cannot preempt, only the loop masks it
+#define TIMER_LOCK()
+#define TIMER_UNLOCK()
+#define LOOP_LOCK() noInterrupts()
+#define LOOP_UNLOCK() interrupts()
+#endif
+
+// canSend() in the loop pushes, the timer pops
+static SpscRing<CanTxFrame, CAN_TIMER_TX_QUEUE> tx_queue;
+
+#if defined(USE_CAN_STATS)
+// Frames the timer has sent, counted by the loop
+static SpscRing<CanTxFrame, 16> tx_done;
+#endif
+
+// Last frame of every ID, repeated by the timer while the loop is stalled
+struct CanTimerSlot {
+    CanTxFrame frame;
+    uint16_t interval_ms;  // Between the loop's last two frames, 0 to not repeat
+    uint16_t queued_ms;
+    uint16_t sent_ms;
+};
+
+static CanTimerSlot slots[CAN_TIMER_SLOTS];
+static uint8_t slot_count = 0;
+
+// Written by the timer and read by the loop under the lock. The tick count is 32 bits so it
+// does not wrap during a stall, ms_count only times the repeats.
+static volatile uint16_t ms_count = 0;
+static volatile uint32_t ticks_counted = 0;
+static volatile uint32_t repeated_frames = 0;
+
+// Written by the loop under the lock
+static volatile uint32_t ticks_taken = 0;
+static uint32_t late_ticks = 0;
+
+// Only frames the loop sent at most this far apart are repeated
+#define CAN_TIMER_REPEAT_MAX_MS 1000
+
+static void sent(const CanTxFrame& frame) {
+#if defined(USE_CAN_STATS)
+    tx_done.push(frame);
+#else
+    (void)frame;
+#endif
+}
+
+// The slot that is most overdue, -1 if none is or the loop is keeping up
+static int8_t overdueSlot(uint16_t now) {
+    if (ticks_counted - ticks_taken < CAN_TIMER_STALL_TICKS) {
+        return -1;
+    }
+    int8_t found = -1;
+    uint16_t most = 0;
+    for (uint8_t i = 0; i < slot_count; ++i) {
+        const CanTimerSlot& slot = slots[i];
+        if (!slot.interval_ms) {
+            continue;
+        }
+        const uint16_t since = now - slot.sent_ms;
+        if (since >= slot.interval_ms && (found < 0 || since - slot.interval_ms >= most)) {
+            found = i;
+            most = since - slot.interval_ms;
+        }
+    }
+    return found;
+}
+
+// Every 1 ms
+static void canTimerInterrupt() {
+    static uint8_t tick_ms = 0;
+    static uint8_t gap_ms = 0;
+
+    TIMER_LOCK();
+    const uint16_t now = ++ms_count;
+    if (++tick_ms == 10) {
+        tick_ms = 0;
+        ticks_counted++;
+    }
+    TIMER_UNLOCK();
+
+    // The same 3 ms between frames as the polled TX gate in canService()
+    if (gap_ms < 3) {
+        gap_ms++;
+        if (gap_ms < 3) {
+            return;
+        }
+    }
+
+    CanTxFrame frame;
+    if (tx_queue.pop(frame)) {
+        if (canTransmit(frame)) {
+            sent(frame);
+        }
+        gap_ms = 0;
+        return;
+    }
+
+    TIMER_LOCK();
+    const int8_t i = overdueSlot(now);
+    if (i >= 0) {
+        slots[i].sent_ms = now;
+        frame = slots[i].frame;
+        repeated_frames++;
+    }
+    TIMER_UNLOCK();
+
+    if (i >= 0) {
+        if (canTransmit(frame)) {
+            sent(frame);
+        }
+        gap_ms = 0;
+    }
+}
+
+#if defined(__AVR__)
+
+ISR(TIMER1_COMPA_vect) {
+    canTimerInterrupt();
+}
+
+void canTimerBegin() {
+    noInterrupts();
+    TCCR1A = 0;
+    TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10);  // CTC mode, clock / 64
+    TCNT1 = 0;
+    OCR1A = F_CPU / 64 / 1000 - 1;
+    TIMSK1 |= (1 << OCIE1A);
+    interrupts();
+}
+
+#elif defined(TEENSYDUINO)
+
+static IntervalTimer timer;
+
+void canTimerBegin() {
+    timer.begin(canTimerInterrupt, 1000);
+}
+
+#elif defined(ESP32)
+
+#include "esp_timer.h"
+
+// Runs in the esp_timer task, which may use the TWAI driver unlike an ISR
+static void onTimer(void*) {
+    canTimerInterrupt();
+}
+
+void canTimerBegin() {
+    esp_timer_create_args_t args = {};
+    args.callback = onTimer;
+    args.name = "can";
+    esp_timer_handle_t timer;
+    esp_timer_create(&args, &timer);
+    esp_timer_start_periodic(timer, 1000);
+}
+
+#else
+    #error "USE_CAN_TIMER_TX has no timer for this board"
+#endif
+
+uint32_t canTimerTakeTicks() {
+    LOOP_LOCK();
+    const uint32_t ticks = ticks_counted - ticks_taken;
+    ticks_taken += ticks;
+    LOOP_UNLOCK();
+
+    if (ticks > 1) {
+        late_ticks += ticks - 1;
+    }
+    return ticks;
+}
+
+uint32_t canTimerLateTicks() {
+    return late_ticks;
+}
+
+uint32_t canTimerRepeatedFrames() {
+    LOOP_LOCK();
+    const uint32_t frames = repeated_frames;
+    LOOP_UNLOCK();
+    return frames;
+}
+
+bool canTimerQueue(uint32_t id, const uint8_t* data, uint8_t len) {
+    CanTxFrame frame;
+    frame.id = id;
+    frame.len = len;
+    memcpy(frame.data, data, len);
+    if (!tx_queue.push(frame)) {
+        return false;
+    }
+
+    LOOP_LOCK();
+    const uint16_t now = ms_count;
+    uint8_t i = 0;
+    while (i < slot_count && slots[i].frame.id != id) {
+        ++i;
+    }
+    if (i == slot_count && slot_count < CAN_TIMER_SLOTS) {
+        slot_count++;
+        slots[i].interval_ms = 0;
+        slots[i].queued_ms = now;
+    }
+    if (i < slot_count) {
+        CanTimerSlot& slot = slots[i];
+        const uint16_t interval = now - slot.queued_ms;
+        slot.frame = frame;
+        slot.interval_ms = interval <= CAN_TIMER_REPEAT_MAX_MS ? interval : 0;
+        slot.queued_ms = now;
+        slot.sent_ms = now;
+    }
+    LOOP_UNLOCK();
+    return true;
+}
+
+bool canTimerQueueFull() {
+    return tx_queue.isFull();
+}
+
+#if defined(USE_CAN_STATS)
+void canTimerRecordStats() {
+    CanTxFrame frame;
+    while (tx_done.pop(frame)) {
+        canStatsRecord(frame.id, frame.data, frame.len, CAN_STATS_TX);
+    }
+}
+#endif
+
+#endif // USE_CAN_TIMER_TX
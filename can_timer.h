@@ -0,0 +1,61 @@
+#pragma once
+
+#include "config.h"
+#include <stdint.h>
+
+#if defined(USE_CAN_TIMER_TX)
+
+#if defined(USE_MCP_CAN_SPI)
+    #error "USE_CAN_TIMER_TX cannot share the SPI bus of the MCP2515 with canPoll(), use the serial adapter or TWAI"
+#endif
+
+/*
+    Timer driven CAN timing
+
+    A 1 ms hardware timer counts the 10 ms scheduler ticks and sends the frames
+    3 ms apart, so neither depends on how long the main loop takes. The loop
+    still builds the frames: canService() catches up on the ticks counted since
+    its last call and the frame builders' canSend() puts the frames into a short
+    queue that the timer empties. Ticks the loop was too busy to run on time are
+    counted, see canTimerLateTicks().
+
+    The timer keeps the last frame of every ID. When the loop has not taken a
+    tick for CAN_TIMER_STALL_TICKS, e.g. during a blocking I2C or serial call, the
+    timer sends these again at the interval the loop last sent each ID at, so
+    the cluster does not see the bus go quiet. They repeat the last values,
+    counters and checksums included, until the loop builds new ones.
+
+    Timers used: Timer1 on AVR (analogWrite() on its pins stops working),
+    IntervalTimer on Teensy 3/4 and esp_timer on ESP32.
+*/
+
+struct CanTxFrame {
+    uint32_t id;
+    uint8_t len;
+    uint8_t data[8];
+};
+
+void canTimerBegin();
+
+// Scheduler ticks counted since the last call
+uint32_t canTimerTakeTicks();
+
+// Ticks that were run later than the next one was due
+uint32_t canTimerLateTicks();
+
+// Frames the timer sent again while the loop was stalled
+uint32_t canTimerRepeatedFrames();
+
+// Frame builder side, false if the queue is full
+bool canTimerQueue(uint32_t id, const uint8_t* data, uint8_t len);
+bool canTimerQueueFull();
+
+#if defined(USE_CAN_STATS)
+// Counts the frames the timer has sent since the last call, from the loop
+void canTimerRecordStats();
+#endif
+
+// Sends a frame from the timer, implemented by the adapter. False if it was not accepted.
+bool canTransmit(const CanTxFrame& frame);
+
+#endif
@@ -28,9 +28,73 @@
     #define TWAI_RX_PIN 22
 #endif
 
+// CAN timing from a hardware timer instead of the main loop: the 10 ms scheduler tick and the
+// 3 ms between frames then stay exact while the loop is busy with I2C, serial or prints, and
+// while the loop is stalled the timer repeats the last frame of every ID so the bus does not
+// go quiet. Serial CAN bus or TWAI only. Uses Timer1 on AVR, see can_timer.h.
+//#define USE_CAN_TIMER_TX
+
+#ifndef CAN_TIMER_TX_QUEUE
+    #define CAN_TIMER_TX_QUEUE 2  // Frames built ahead of the timer, a power of two
+#endif
+
+#ifndef CAN_TIMER_SLOTS
+    #define CAN_TIMER_SLOTS 24  // IDs whose last frame is kept for repeating, 19 bytes each
+#endif
+
+#ifndef CAN_TIMER_STALL_TICKS
+    #define CAN_TIMER_STALL_TICKS 3  // 10 ms ticks the loop may miss before frames are repeated
+#endif
+
 // Serial protocol: uncomment for SimHub, otherwise custom binary
 //#define USE_SIMHUB
 
+// SimHub ARQ receive buffering. With a window larger than one SimHub can have that many
+// packets in flight instead of waiting for each acknowledgement. Buffer size must be a
+// power of two, at most 128 on AVR
+#ifndef ARQ_DATA_BUFFER_SIZE
+    #if defined(__AVR__)
+        #define ARQ_DATA_BUFFER_SIZE 32
+    #else
+        #define ARQ_DATA_BUFFER_SIZE 256
+    #endif
+#endif
+
+#ifndef ARQ_WINDOW_SIZE
+    #if defined(__AVR__)
+        #define ARQ_WINDOW_SIZE 1
+    #else
+        #define ARQ_WINDOW_SIZE 8
+    #endif
+#endif
+
+// SimHub link starts at SIMHUB_SERIAL_BAUD, which must match the SimHub device setting.
+// Nothing is negotiated: the firmware cannot ask SimHub for a faster rate, it only accepts
+// the one SimHub requests with its '8' command, up to SIMHUB_MAX_BAUD. If no packet gets
+// through within SIMHUB_BAUD_VERIFY_MS of the switch the board returns to the base rate,
+// where SimHub reconnects after losing the link. A rate with more than
+// SIMHUB_MAX_ERROR_PERCENT failed packets is kept, as the host would not follow a switch,
+// and only refused when SimHub requests it again after a reconnect
+#ifndef SIMHUB_SERIAL_BAUD
+    #define SIMHUB_SERIAL_BAUD 19200
+#endif
+
+#ifndef SIMHUB_MAX_BAUD
+    #if defined(__AVR__)
+        #define SIMHUB_MAX_BAUD 1000000  // No error with a 16 MHz clock
+    #else
+        #define SIMHUB_MAX_BAUD 2000000
+    #endif
+#endif
+
+#ifndef SIMHUB_BAUD_VERIFY_MS
+    #define SIMHUB_BAUD_VERIFY_MS 1000
+#endif
+
+#ifndef SIMHUB_MAX_ERROR_PERCENT
+    #define SIMHUB_MAX_ERROR_PERCENT 10
+#endif
+
 // Serial baud rates
 #ifndef PC_SERIAL_BAUD
     #define PC_SERIAL_BAUD 921600
@@ -58,10 +122,72 @@
     #define SPEED_CALIBRATION 60
 #endif
 
+// High-rate speedometer: 0x1A6 is sent every SPEED_HIGH_RATE_MS instead of on change with a
+// 100 ms keep-alive, so the needle moves in smaller steps at low speed. A multiple of 10 ms up to
+// 100 ms. With the serial adapter 20 ms is the fastest that keeps every deadline, check with
+// tools/can_schedule.py -D USE_SPEED_HIGH_RATE -D SPEED_HIGH_RATE_MS=.. and see
+// tools/odometer_check.py for the distance counting at any rate.
+//#define USE_SPEED_HIGH_RATE
+
+#ifndef SPEED_HIGH_RATE_MS
+    #define SPEED_HIGH_RATE_MS 20
+#endif
+
 #ifndef MAX_RPM
     #define MAX_RPM 8000
 #endif
 
+// Needle lead: the cluster damps the RPM and speed needles, so they trail fast changes. With this
+// the values in 0x0AA and 0x1A6 run ahead of the input by a model of that damping. The lags are
+// the needles' time constants (time to cover ~63% of a step), they differ between cluster
+// variants, film a step change to measure yours. A lag of 0 turns the lead off for that needle.
+// tools/needle_lead.py prints the modelled step response for given lags and gain.
+//#define USE_NEEDLE_LEAD
+
+#ifndef NEEDLE_RPM_LAG_MS
+    #define NEEDLE_RPM_LAG_MS 150
+#endif
+
+#ifndef NEEDLE_SPEED_LAG_MS
+    #define NEEDLE_SPEED_LAG_MS 250
+#endif
+
+#ifndef NEEDLE_LEAD_GAIN
+    #define NEEDLE_LEAD_GAIN 2  // The modelled needle settles this + 1 times faster
+#endif
+
+#ifndef NEEDLE_RPM_MAX_LEAD
+    #define NEEDLE_RPM_MAX_LEAD 1500  // rpm
+#endif
+
+#ifndef NEEDLE_SPEED_MAX_LEAD
+    #define NEEDLE_SPEED_MAX_LEAD 150  // 0.1 km/h
+#endif
+
+// The speed lead adds distance while accelerating and takes it while slowing down, and the limits
+// at 0 and MAX_SPEED_KMH_X10 keep some of it. That is paid back while moving by sending up to this
+// much less or more, so the odometer ends up exact, see tools/odometer_check.py --lead
+#ifndef NEEDLE_SPEED_REPAY
+    #define NEEDLE_SPEED_REPAY 5  // 0.1 km/h
+#endif
+
+// Check-control symbols (0x592): 2 changes are sent per 50 ms, so all 28 symbols turning on at
+// ignition take 700 ms. The shown symbols are refreshed round-robin with at most
+// CHECK_CONTROL_REFRESH_FPS frames per second, each every CHECK_CONTROL_REFRESH_MS at most.
+// Symbols that are off are sent once when they turn off and not repeated.
+#ifndef CHECK_CONTROL_REFRESH_FPS
+    #define CHECK_CONTROL_REFRESH_FPS 4
+#endif
+
+#ifndef CHECK_CONTROL_REFRESH_MS
+    #define CHECK_CONTROL_REFRESH_MS 2000
+#endif
+
+// Custom check-control lights the host can show at the same time
+#ifndef CUSTOM_LIGHTS_MAX
+    #define CUSTOM_LIGHTS_MAX 8
+#endif
+
 // Comment away to hide "SPORT" from the sport gear mode
 #define GEAR_SPORT_TEXT
 
@@ -94,6 +220,54 @@
     #define AD5272_I2C_SCL_PIN 19
 #endif
 
+// Closed loop using the temperature the cluster shows (0x2CA): the sensor is driven past the
+// target by AD5272_FEEDBACK_GAIN times the remaining error, at most AD5272_MAX_OVERSHOOT (0.1 °C)
+#ifndef AD5272_FEEDBACK_GAIN
+    #define AD5272_FEEDBACK_GAIN 2
+#endif
+
+#ifndef AD5272_MAX_OVERSHOOT
+    #define AD5272_MAX_OVERSHOOT 150
+#endif
+
+// Fuel gauge calibration: sweeps the 0x349 sensor levels, records the cluster's 0x330 tank
+// readings and accepts a fitted curve back, see tools/fuel_calibrate.py. Custom binary API only
+//#define USE_FUEL_CALIBRATION
+
+#ifndef FUEL_TABLE_MAX_POINTS
+    #if defined(USE_FUEL_CALIBRATION)
+        #define FUEL_TABLE_MAX_POINTS 16
+    #else
+        #define FUEL_TABLE_MAX_POINTS 6
+    #endif
+#endif
+
+#ifndef FUEL_CALIBRATION_MAX_SAMPLES
+    #define FUEL_CALIBRATION_MAX_SAMPLES 32
+#endif
+
+#ifndef FUEL_CALIBRATION_SETTLE_MS
+    #define FUEL_CALIBRATION_SETTLE_MS 10000  // Readings unchanged this long count as settled
+#endif
+
+#ifndef FUEL_CALIBRATION_TIMEOUT_MS
+    #define FUEL_CALIBRATION_TIMEOUT_MS 60000
+#endif
+
+// Debug: uncomment to measure the CAN bus load and per ID bandwidth and periods.
+// Reported to the PC every CAN_STATS_REPORT_WINDOWS seconds (not with SimHub). The MCP2515 and TWAI
+// acceptance filters are opened so RX covers the whole bus, the serial adapter's byte stream can
+// only be split at handled IDs so its RX figure counts those alone
+//#define USE_CAN_STATS
+
+#ifndef CAN_STATS_MAX_IDS
+    #define CAN_STATS_MAX_IDS 24  // TX and RX are tracked separately
+#endif
+
+#ifndef CAN_STATS_REPORT_WINDOWS
+    #define CAN_STATS_REPORT_WINDOWS 5
+#endif
+
 // Debug: uncomment to log CAN frames from cluster
 //#define READ_FRAMES_FROM_CLUSTER_1B4  // Speed & handbrake
 //#define READ_FRAMES_FROM_CLUSTER_2C0  // Brightness/light sensor
@@ -5,6 +5,13 @@
 #include "pc_printf.h"
 #include "ad5272_ambient.h"
 #include "can_adapter.h"
+#include "can_dispatch.h"
+#include "can_signal.h"
+#include "can_stats.h"
+#include "can_timer.h"
+#include "fuel_calibration.h"
+#include "input_cache.h"
+#include "spsc_ring.h"
 
 /*
     See config.h for options!
@@ -20,6 +27,7 @@
 #if defined(USE_AD5272_AMBIENT)
     #include "ad5272_ambient.h"
     AD5272Ambient ambientTemp;
+    SAmbient s_ambient;
 #endif
 
 // State
@@ -27,97 +35,207 @@ STimers s_timers;
 SRefueling s_refueling;
 SInput s_input;
 
+// Inputs each cached frame is encoded from, see input_cache.h
+InputCache ignitionCache(IN_IGNITION);
+InputCache rpmCache(IN_RPM);
+InputCache lightsCache(IN_LIGHTS);
+InputCache indicatorCache(IN_INDICATOR);
+InputCache engineTempCache(IN_TEMPS | IN_IGNITION);
+InputCache vehicleDynamicsCache(IN_SPEED);
+InputCache handbrakeCache(IN_HANDBRAKE);
+InputCache timeCache(IN_TIME);
+InputCache gearboxCache(IN_GEAR);
+InputCache oilLevelCache(IN_WARNINGS);
+InputCache cruiseCache(IN_CRUISE);
+
 bool canSendIgnitionFrame() {
     const uint32_t ID = 0x130;
-    static uint8_t counter_on = 0xE2;
-    static uint8_t byte0 = 0x00;
-
-    if (s_input.engine_running) {
-        byte0 = 0x45;
-    } else if (s_input.ignition >= IG_ON) {
-       byte0 = 0x55;
-    } else if (s_input.ignition == IG_ACCESSORY) {
-        byte0 = 0x41;
-    } else {
-        byte0 = 0x00;
+    typedef CanCounter<32, 8> Counter;
+    static uint8_t data[5] = {0x00, 0x42, 0x69, 0x8F, 0xE2};
+
+    if (ignitionCache.refresh()) {
+        if (s_input.engine_running) {
+            data[0] = 0x45;
+        } else if (s_input.ignition >= IG_ON) {
+            data[0] = 0x55;
+        } else if (s_input.ignition == IG_ACCESSORY) {
+            data[0] = 0x41;
+        } else {
+            data[0] = 0x00;
+        }
     }
 
-    uint8_t data[8] = {byte0, 0x42, 0x69, 0x8F, counter_on++, 0, 0, 0};
-    canSend(ID, data);
+    canSend(ID, data, sizeof(data));
+    Counter::next(data);
     return true;
 }
 
 bool canSendRPM() {
     const uint32_t ID = 0x0AA;
-    uint16_t rpm_val = min(s_input.rpm, (uint16_t)MAX_RPM) * 4;
-    uint8_t data[8] = {0x5F, 0x59, 0xFF, 0x00,
-                       (uint8_t)(rpm_val & 0xFF), (uint8_t)(rpm_val >> 8),
-                       0x80, 0x99};
+    typedef CanSignal<32, 16, 1, 4> EngineSpeed;  // rpm
+    static uint8_t data[8] = {0x5F, 0x59, 0xFF, 0x00, 0x00, 0x00, 0x80, 0x99};
+
+    // Called every 10 ms, sent every 20 ms while revving and every 50 ms while steady like the
+    // fixed rate it used to be sent at. Timed in scheduler ticks as a call is skipped while the
+    // previous one is still queued.
+    const uint16_t changeStep = 25;  // rpm
+    const uint8_t minTicks = 2;
+    const uint8_t keepAliveTicks = 5;
+    static AdaptiveRate rate;
+
+    uint16_t rpm = min(s_input.rpm, (uint16_t)MAX_RPM);
+#if defined(USE_NEEDLE_LEAD)
+    static NeedleLead lead;
+    static uint16_t followed_at = s_timers.canCounter;
+    rpm = lead.apply(rpm, NEEDLE_RPM_LAG_MS, NEEDLE_LEAD_GAIN, NEEDLE_RPM_MAX_LEAD, MAX_RPM);
+#endif
+
+    bool due = rate.due(rpm, changeStep, s_timers.canCounter, minTicks, keepAliveTicks);
+#if defined(USE_NEEDLE_LEAD)
+    // The needle moves toward the last value sent for the ticks since the last call
+    uint16_t elapsed_ticks = min((uint16_t)(s_timers.canCounter - followed_at), (uint16_t)100);
+    lead.follow(rate.last, elapsed_ticks * 10, NEEDLE_RPM_LAG_MS);
+    followed_at = s_timers.canCounter;
+#endif
+    if (!due) {
+        return false;
+    }
+
+#if defined(USE_NEEDLE_LEAD)
+    // The lead changes the value between input updates
+    EngineSpeed::encode(data, rpm);
+#else
+    if (rpmCache.refresh()) {
+        EngineSpeed::encode(data, rpm);
+    }
+#endif
+
     canSend(ID, data);
     return true;
 }
 
-inline uint16_t speedIncrement(uint16_t speed_kmh_x10, uint32_t calibration) {
-    // Keep the increments in accumulator to avoid losing precision to rounding every cycle
+// The largest elapsed time the accumulator takes in one step
+#define SPEED_INCREMENT_MAX_TICKS 1000  // 0.25 ms
+static_assert((uint64_t)MAX_SPEED_KMH_X10 * 1360 * SPEED_INCREMENT_MAX_TICKS + 4000000 <= 0xFFFFFFFFull,
+              "speedIncrement() accumulator would overflow");
+
+uint16_t speedIncrement(uint16_t speed_kmh_x10, uint32_t calibration, uint32_t ticks) {
+    // Keep the increments in accumulator to avoid losing precision to rounding every cycle.
+    // Pulses counted * 4000000 + accumulator always equals the exact sum of speed * (1360 -
+    // calibration) * elapsed ticks, so the odometer is the same for any call period.
     static uint32_t accumulator = 0;
-    accumulator += (uint32_t)speed_kmh_x10 * (1360 - calibration);
-    uint16_t result = accumulator / 10000;
-    accumulator %= 10000;
+    uint16_t result = 0;
+    while (ticks > 0) {
+        uint16_t step = min(ticks, (uint32_t)SPEED_INCREMENT_MAX_TICKS);
+        accumulator += (uint32_t)speed_kmh_x10 * (1360 - calibration) * step;
+        result += accumulator / 4000000;
+        accumulator %= 4000000;
+        ticks -= step;
+    }
     return result;
 }
 
 bool canSendSpeed() {
     const uint32_t ID = 0x1A6;
-    static uint16_t last_speed_counter = 0;
-    static uint16_t last_tick_counter = 0;
-
-    uint16_t speed_increment = speedIncrement(s_input.speed, SPEED_CALIBRATION);
-    uint16_t current_speed_counter = speed_increment + last_speed_counter;
+    typedef CanSignal<0, 16> Distance1;   // Wheel pulses, all three carry the same count
+    typedef CanSignal<16, 16> Distance2;
+    typedef CanSignal<32, 16> Distance3;
+    typedef CanSignal<48, 12> Tick;
+    static uint8_t frame[8] = {0, 0, 0, 0, 0, 0, 0, 0xF0};
+    static uint16_t speed_counter = 0;
+    static uint16_t tick_counter = 0;
+
+#if defined(USE_SPEED_HIGH_RATE)
+    // Called and sent every SPEED_HIGH_RATE_MS
+    const uint8_t keepAliveCalls = 1;
+    static_assert(SPEED_HIGH_RATE_MS % 10 == 0 && SPEED_HIGH_RATE_MS >= 10 && SPEED_HIGH_RATE_MS <= 100,
+                  "SPEED_HIGH_RATE_MS must be a multiple of 10 ms up to 100 ms");
+#else
+    // Called every 50 ms, sent then while the speed changes and every 100 ms while steady.
+    // The counters advance on every call so the distance and time are the same either way.
+    const uint8_t keepAliveCalls = 2;
+#endif
+    const uint16_t changeStep = 5;  // 0.1 km/h
+    static AdaptiveRate rate;
+
+    // The counters follow the time actually passed, a call delayed in the queue or by a slow loop
+    // makes the next interval shorter and no time is lost to rounding
+    static uint32_t last_us = micros();
+    uint32_t ticks = (micros() - last_us) / 250;  // 0.25 ms, the unit of Tick
+    last_us += ticks * 250;
+
+    uint16_t speed = min(s_input.speed, (uint16_t)MAX_SPEED_KMH_X10);
+#if defined(USE_NEEDLE_LEAD)
+    // The cluster shows the speed the counters imply, so the lead changes the distance counted.
+    // What it adds and takes is summed and paid back by sending up to NEEDLE_SPEED_REPAY less or
+    // more while moving, the limits at 0 and the top speed would otherwise leave the odometer off
+    // for good. After a stall of a second or more the needle model is stale, the input is sent.
+    static NeedleLead lead;
+    static int32_t lead_distance = 0;  // Sum of (sent - input speed) * ticks
+    uint16_t led = speed;
+    if (ticks < 4000) {
+        int32_t repay = 0;
+        if (speed > 0 && ticks > 0) {
+            repay = constrain(lead_distance / (int32_t)ticks, -NEEDLE_SPEED_REPAY, NEEDLE_SPEED_REPAY);
+        }
+        led = lead.apply(speed, NEEDLE_SPEED_LAG_MS, NEEDLE_LEAD_GAIN, NEEDLE_SPEED_MAX_LEAD, MAX_SPEED_KMH_X10);
+        int32_t sent = constrain((int32_t)led - repay, 0, (int32_t)MAX_SPEED_KMH_X10);
+        lead_distance += (sent - speed) * (int32_t)ticks;
+        speed = sent;
+    }
+    // The model leaves the repayment out, the lead would otherwise work against it
+    lead.follow(led, min(ticks / 4, (uint32_t)1000), NEEDLE_SPEED_LAG_MS);
+#endif
 
-    uint8_t low = current_speed_counter & 0xFF;
-    uint8_t high = current_speed_counter >> 8;
+    speed_counter += speedIncrement(speed, SPEED_CALIBRATION, ticks);
+    tick_counter += ticks;
 
-    uint16_t tick_counter = last_tick_counter + 400;
+    static uint16_t calls = 0;
+    if (!rate.due(speed, changeStep, ++calls, 1, keepAliveCalls)) {
+        return false;
+    }
 
-    uint8_t frame[8] = {
-        low, high,
-        low, high,
-        low, high,
-        (uint8_t)(tick_counter & 0xFF),
-        (uint8_t)(0xF0 | ((tick_counter >> 8) & 0x0F))
-    };
+    Distance1::put(frame, speed_counter);
+    Distance2::put(frame, speed_counter);
+    Distance3::put(frame, speed_counter);
+    Tick::put(frame, tick_counter);
 
     canSend(ID, frame);
-    last_speed_counter = current_speed_counter;
-    last_tick_counter = tick_counter;
     return true;
 }
 
 bool canSendLights() {
     const uint32_t ID = 0x21A;
-    static uint8_t frame[8] = {0x00, 0x00, 0xF7, 0, 0, 0, 0, 0};
+    typedef CanSignal<0, 8> Lights;  // CAN_LIGHTS bits
+    static uint8_t frame[3] = {0x00, 0x00, 0xF7};
 
-    uint8_t lights = 0;
-    if (s_input.light_lowbeam || s_input.light_highbeam) lights |= L_BACKLIGHT;
-    if (s_input.light_fog) lights |= L_DIP;
-    if (s_input.light_highbeam) lights |= L_MAIN;
-    if (s_input.light_fog) lights |= L_FOG;
+    if (lightsCache.refresh()) {
+        uint8_t lights = 0;
+        if (s_input.light_lowbeam || s_input.light_highbeam) lights |= L_BACKLIGHT;
+        if (s_input.light_fog) lights |= L_DIP;
+        if (s_input.light_highbeam) lights |= L_MAIN;
+        if (s_input.light_fog) lights |= L_FOG;
 
-    frame[0] = lights;
-    canSend(ID, frame);
+        Lights::put(frame, lights);
+    }
+
+    canSend(ID, frame, sizeof(frame));
     return true;
 }
 
 bool canSendIndicator() {
     const uint32_t ID = 0x1F6;
-    uint8_t frame[8] = {0x80, 0xF0, 0, 0, 0, 0, 0, 0};
-
-    switch (s_input.indicator_state) {
-        case I_LEFT:    frame[0] = 0x91; break;
-        case I_RIGHT:   frame[0] = 0xA1; break;
-        case I_HAZZARD: frame[0] = 0xB1; break;
-        case I_OFF:
-        default:        frame[0] = 0x80; break;
+    typedef CanSignal<0, 8> Indicator;  // 0x80 off, 0x91 left, 0xA1 right, 0xB1 hazard
+    static uint8_t frame[8] = {0x80, 0xF0, 0, 0, 0, 0, 0, 0};
+
+    if (indicatorCache.refresh()) {
+        switch (s_input.indicator_state) {
+            case I_LEFT:    Indicator::put(frame, 0x91); break;
+            case I_RIGHT:   Indicator::put(frame, 0xA1); break;
+            case I_HAZZARD: Indicator::put(frame, 0xB1); break;
+            case I_OFF:
+            default:        Indicator::put(frame, 0x80); break;
+        }
     }
     canSend(ID, frame);
     return true;
@@ -125,53 +243,46 @@ bool canSendIndicator() {
 
 bool canSendSteeringWheel() {
     const uint32_t ID = 0x0C4;
-    static uint8_t frame[8] = {0x83, 0xFD, 0xFC, 0x00, 0x00, 0xFF, 0xF1, 0x00};
+    static uint8_t frame[7] = {0x83, 0xFD, 0xFC, 0x00, 0x00, 0xFF, 0xF1};
     frame[1] = 0; frame[2] = 0;
-    canSend(ID, frame);
+    canSend(ID, frame, sizeof(frame));
     return true;
 }
 
 bool canSendAbs() {
     const uint32_t ID = 0x19E;
-    static uint8_t counter = 0;
-
-    uint8_t frame[8] = {
-        0x00, 0xE0, 0x00, 0xFC, 0xCC, 0x00, 0x00, 0x00
-    };
+    typedef CanSignal<20, 4> Rotation;  // Cycles 0-2 with the counter, low nibble is always 0x03
+    typedef CanCounter<56, 8> Counter;
+    static uint8_t frame[8] = {0x00, 0xE0, 0x03, 0xFC, 0xCC, 0x00, 0x00, 0x00};
 
-    // Byte 2 rotation (high nibble cycles, low nibble is always 0x03)
-    uint8_t rotate_nibble = (counter % 3) << 4;
-    frame[2] = rotate_nibble | 0x03;
-    frame[5] = 0x00;
-    frame[6] = 0x00;
-    frame[7] = counter++;
+    Rotation::put(frame, Counter::get(frame) % 3);
 
     canSend(ID, frame);
+    Counter::next(frame);
     return true;
 }
 
 bool canSendEngineTempAndFuelInjection() {
     const uint32_t ID = 0x1D0;
+    typedef CanSignal<0, 8, 1, 1, -48> WaterTemp;   // °C
+    typedef CanSignal<8, 8, 1, 1, -48> OilTemp;     // °C
+    typedef CanCounter<16, 4> Alive;
+    typedef CanSignal<20, 2> EngineRunState;        // 0x0 = off, 0x1 = starting, 0x2 = running, 0x3 = invalid
+    typedef CanSignal<32, 16> FuelInjected;         // Cumulative
     static uint8_t frame[8] = {0x8B, 0xFF, 0x00, 0xCD, 0x00, 0x00, 0xCD, 0xA8};
-    const uint8_t engine_run_state = s_input.engine_running ? 0x2 : 0x0;  // 0x0 = off, 0x1 = starting, 0x2 = running, 0x3 = invalid
     static uint16_t fuel_injection_total = 0;
 
-    frame[0] = s_input.water_temp + 48;
-    frame[1] = s_input.oil_temp + 48;
-
-    // Update alive counter (lower 4 bits)
-    static uint8_t alive_counter = 0;
-    alive_counter = (alive_counter + 1) & 0x0F;
+    if (engineTempCache.refresh()) {
+        WaterTemp::encode(frame, s_input.water_temp);
+        OilTemp::encode(frame, s_input.oil_temp);
+        EngineRunState::put(frame, s_input.engine_running ? 0x2 : 0x0);
+    }
 
-    // Encode engine_run_state into bits 4–5, preserve upper/lower bits
-    frame[2] = alive_counter;
-    frame[2] |= (engine_run_state & 0x03) << 4; // bits 4–5
+    Alive::next(frame);
 
     // Value is cumulative fuel injected in 100 ms cycles (account the speed error and tiny inaccuracy by calibration)
     fuel_injection_total += ((uint32_t)s_input.fuel_injection * (1000 - SPEED_CALIBRATION + 28)) / 1000;
-
-    frame[4] = fuel_injection_total & 0xFF;
-    frame[5] = (fuel_injection_total >> 8) & 0xFF;
+    FuelInjected::put(frame, fuel_injection_total);
 
     canSend(ID, frame);
     return true;
@@ -179,17 +290,19 @@ bool canSendEngineTempAndFuelInjection() {
 
 bool canSendAbsCounter() {
     const uint32_t ID = 0x0C0;
-    static uint8_t frame[8] = {0xF0, 0xFF, 0, 0, 0, 0, 0, 0};
-    canSend(ID, frame);
-    frame[0] = ((frame[0] + 1) | 0xF0);
+    typedef CanCounter<0, 4> Counter;
+    static uint8_t frame[2] = {0xF0, 0xFF};
+    canSend(ID, frame, sizeof(frame));
+    Counter::next(frame);
     return true;
 }
 
 bool canSendAirbagCounter() {
     const uint32_t ID = 0x0D7;
+    typedef CanCounter<0, 8> Counter;
     static uint8_t frame[8] = {0xC3, 0xFF, 0, 0, 0, 0, 0, 0};
     canSend(ID, frame);
-    frame[0]++;
+    Counter::next(frame);
     return true;
 }
 
@@ -197,113 +310,151 @@ bool canSendAirbagCounter() {
 // https://github.com/HeinrichG-V12/E65_ReverseEngineering/blob/main/docs/0x1A0.md
 bool canSendVehicleDynamics() {
     const uint32_t ID = 0x1A0;
-    static uint8_t alive_counter = 0;
-
-    // Moving forward, backward not supported yet
-    uint16_t v_veh_raw = (uint16_t)s_input.speed;
-    uint8_t st_veh_dvco = s_input.speed >= 10 ? 1 : 0;
-    float acc_long = 0.f;       // m/s²
-    float acc_lat  = 0.f;       // m/s²
-    float yaw_rate = 0.f;       // deg/s
-
-    int16_t acc_long_raw = (int16_t)(acc_long / 0.025f);
-    int16_t acc_lat_raw  = (int16_t)(acc_lat  / 0.025f);
-    int16_t yaw_rate_raw = (int16_t)(yaw_rate / 0.05f);
-
-    uint8_t frame[8] = {0};
-
-    frame[0] = v_veh_raw & 0xFF;
-    frame[1] = ((v_veh_raw >> 8) & 0x0F) | ((st_veh_dvco & 0x07) << 4);
-    frame[2] = acc_long_raw & 0xFF;
-    frame[3] = ((acc_long_raw >> 8) & 0x0F) | ((acc_lat_raw & 0x0F) << 4);
-    frame[4] = (acc_lat_raw >> 4) & 0xFF;
-    frame[5] = yaw_rate_raw & 0xFF;
-    frame[6] = ((yaw_rate_raw >> 8) & 0x0F) | ((alive_counter++ & 0x0F) << 4);
+    typedef CanSignal<0, 12> VehicleSpeed;                 // 0.1 km/h, moving forward, backward not supported yet
+    typedef CanSignal<12, 3> DrivingDirection;             // 1 when moving
+    typedef CanSignal<16, 12, 1, 40> LongitudinalAccel;    // m/s²
+    typedef CanSignal<28, 12, 1, 40> LateralAccel;         // m/s²
+    typedef CanSignal<40, 12, 1, 20> YawRate;              // deg/s
+    typedef CanCounter<52, 4> Alive;
+    typedef CanXorChecksum<7> Checksum;
+    static uint8_t frame[8] = {0};
 
-    uint8_t checksum = 0x00;
-    for (int i = 0; i < 7; i++) {
-        checksum ^= frame[i];
+    if (vehicleDynamicsCache.refresh()) {
+        VehicleSpeed::put(frame, s_input.speed);
+        DrivingDirection::put(frame, s_input.speed >= 10 ? 1 : 0);
+        LongitudinalAccel::encode(frame, 0);
+        LateralAccel::encode(frame, 0);
+        YawRate::encode(frame, 0);
     }
-    frame[7] = checksum;
 
+    Checksum::put(frame);
     canSend(ID, frame);
+    Alive::next(frame);
     return true;
 }
 
-FuelLevelPoint fuelTableLeft[] = {
-    {1.00f, 9700},
-    {0.875f, 8200},
-    {0.75f, 6250},
-    {0.50f, 3600},
-    {0.25f, 1950},
-    {0.00f,  625}
-};
-
-FuelLevelPoint fuelTableRight[] = {
-    {1.00f, 8400},
-    {0.875f, 5400},
-    {0.75f, 4600},
-    {0.50f, 3350},
-    {0.25f, 2200},
-    {0.00f, 950}
-};
+// Calibration points are written as fractions of a full tank and converted at compile time
+constexpr FuelLevelPoint fuelPoint(float fraction, uint16_t meter_level) {
+    return FuelLevelPoint{(uint16_t)(fraction * FUEL_FULL + 0.5f), meter_level};
+}
 
-// This is bit heavy floating point calculation but fine for now
-uint16_t interpolateFuel(float percent, struct FuelLevelPoint table[], int size) {
-    for (int i = 0; i < size - 1; ++i) {
-        if (percent >= table[i + 1].fuel_percent) {
-            float range = table[i].fuel_percent - table[i + 1].fuel_percent;
-            float alpha = (percent - table[i + 1].fuel_percent) / range;
-            return (uint16_t)(table[i + 1].meter_level +
-                              alpha * (table[i].meter_level - table[i + 1].meter_level));
+FuelTable fuelTableLeft = {{
+    fuelPoint(1.00f, 9700),
+    fuelPoint(0.875f, 8200),
+    fuelPoint(0.75f, 6250),
+    fuelPoint(0.50f, 3600),
+    fuelPoint(0.25f, 1950),
+    fuelPoint(0.00f,  625)
+}, 6};
+
+FuelTable fuelTableRight = {{
+    fuelPoint(1.00f, 8400),
+    fuelPoint(0.875f, 5400),
+    fuelPoint(0.75f, 4600),
+    fuelPoint(0.50f, 3350),
+    fuelPoint(0.25f, 2200),
+    fuelPoint(0.00f, 950)
+}, 6};
+
+// Linear between the calibration points in integer math, truncated like the float version was
+uint16_t interpolateFuel(uint16_t fuel, const FuelTable& table) {
+    const FuelLevelPoint* points = table.points;
+    for (uint8_t i = 0; i < table.size - 1; ++i) {
+        if (fuel >= points[i + 1].fuel) {
+            uint16_t range = points[i].fuel - points[i + 1].fuel;
+            int32_t rise = (int32_t)points[i].meter_level - points[i + 1].meter_level;
+            return points[i + 1].meter_level + (int32_t)(fuel - points[i + 1].fuel) * rise / range;
         }
     }
 
-    return table[size - 1].meter_level; // fallback for <0%
-}
-
-inline float currentFuelToFloat() {
-    return (float)s_input.fuel / 1000.f;
+    return points[table.size - 1].meter_level; // fallback for <0%
 }
 
 bool canSendFuel() {
     const uint32_t ID = 0x349;
+    typedef CanSignal<0, 16> FuelLevelLeft;   // Sensor value, not linear to the fuel amount
+    typedef CanSignal<16, 16> FuelLevelRight;
     static uint8_t frame[8] = {0};
-    static float previousFuel = currentFuelToFloat();
-
-    const float maxDeltaRatePerSecond = 0.015f;
-    const float callIntervalSeconds = 0.2f;
-    const float maxDelta = maxDeltaRatePerSecond * callIntervalSeconds;
-
-    float fuel = currentFuelToFloat();
-    if (fuel > 1.0f) fuel = 1.0f;
-    if (fuel < 0.0f) fuel = 0.0f;
+    static uint16_t previousFuel = min(s_input.fuel, (uint16_t)FUEL_FULL);
+    static bool encoded = false;
+
+    // Per mille per call, one call per 200 ms. 1.5 % per second always works, up to 20 % per
+    // second is tried while the tank readings in 0x330 show that the cluster keeps up.
+    const uint16_t callIntervalMs = 200;
+    const uint16_t minDelta = 15 * callIntervalMs / 1000;
+    const uint16_t maxDelta = 200 * callIntervalMs / 1000;
+    // Level change without any response from the cluster that counts as it having fallen behind
+    const uint16_t stallLevel = 50;
+    const uint8_t stallHoldCalls = 10;
+
+    static uint16_t delta = minDelta;
+    static uint16_t movedSinceProgress = 0;
+    static uint8_t holdCalls = 0;
+    static uint16_t lastTankSum = 0;
+
+    uint16_t fuel = min(s_input.fuel, (uint16_t)FUEL_FULL);
+    uint16_t tankSum = s_refueling.tankLeft + s_refueling.tankRight;
+    bool refueling = fuel > previousFuel + delta || fuel + delta < previousFuel;
+
+    if (!refueling || !s_refueling.tankReceived) {
+        delta = minDelta;
+        movedSinceProgress = 0;
+        holdCalls = 0;
+    } else if (fuel > previousFuel ? tankSum > lastTankSum : tankSum < lastTankSum) {
+        // The cluster follows, try faster
+        delta = min((uint16_t)(delta + minDelta), maxDelta);
+        movedSinceProgress = 0;
+        holdCalls = 0;
+    } else if (movedSinceProgress >= stallLevel) {
+        // Too fast, the cluster would ignore the change. Slow down and let it catch up first.
+        delta = max((uint16_t)(delta / 2), minDelta);
+        movedSinceProgress = 0;
+        holdCalls = stallHoldCalls;
+    }
+    lastTankSum = tankSum;
 
-    float delta = fuel - previousFuel;
+    uint16_t step = holdCalls ? 0 : delta;
+    if (holdCalls) {
+        holdCalls--;
+    }
 
-    if (delta > maxDelta) {
-        fuel = previousFuel + maxDelta;
+    if (fuel > previousFuel + step) {
+        fuel = previousFuel + step;
         s_refueling.counter = s_refueling.counterCycles;
         digitalWrite(REFUELING_LED_PIN, HIGH);
-    } else if (delta < -maxDelta) {
-        fuel = previousFuel - maxDelta;
+    } else if (fuel + step < previousFuel) {
+        fuel = previousFuel - step;
         s_refueling.counter = s_refueling.counterCycles;
         digitalWrite(REFUELING_LED_PIN, HIGH);
     }
 
-    previousFuel = fuel;
+    if (refueling) {
+        movedSinceProgress += fuel > previousFuel ? fuel - previousFuel : previousFuel - fuel;
+    }
 
-    // Fuel gauge is not linear so match it here
-    uint16_t levelLeft = interpolateFuel(fuel, fuelTableLeft, sizeof(fuelTableLeft) / sizeof(fuelTableLeft[0]));
+    bool sweeping = false;
+#if defined(USE_FUEL_CALIBRATION)
+    uint16_t sweepLeft, sweepRight;
+    if (fuelCalibrationLevels(sweepLeft, sweepRight)) {
+        FuelLevelLeft::put(frame, sweepLeft);
+        FuelLevelRight::put(frame, sweepRight);
+        sweeping = true;
+        encoded = false;  // Back to the curve when the sweep is over
+    } else if (fuelCalibrationTableChanged()) {
+        encoded = false;
+    }
+#endif
 
-    frame[0] = levelLeft & 0xFF;
-    frame[1] = (levelLeft >> 8);
+    // Fuel gauge is not linear so match it here, only when the level moved
+    if ((fuel != previousFuel || !encoded) && !sweeping) {
+        FuelLevelLeft::put(frame, interpolateFuel(fuel, fuelTableLeft));
 
-    // There are two sensors
-    uint16_t levelRight = interpolateFuel(fuel, fuelTableRight, sizeof(fuelTableRight) / sizeof(fuelTableRight[0]));
+        // There are two sensors
+        FuelLevelRight::put(frame, interpolateFuel(fuel, fuelTableRight));
+        encoded = true;
+    }
 
-    frame[2] = levelRight & 0xFF;
-    frame[3] = (levelRight >> 8);
+    previousFuel = fuel;
 
     canSend(ID, frame);
     return true;
@@ -311,24 +462,33 @@ bool canSendFuel() {
 
 bool canSendHandbrake() {
     const uint32_t ID = 0x34F;
+    typedef CanSignal<0, 8> Handbrake;  // 0xFE on, 0xFD off
     static uint8_t frame[8] = {0xFE, 0xFF, 0, 0, 0, 0, 0, 0};
-    frame[0] = s_input.handbrake ? 0xFE : 0xFD;
+    if (handbrakeCache.refresh()) {
+        Handbrake::put(frame, s_input.handbrake ? 0xFE : 0xFD);
+    }
     canSend(ID, frame);
     return true;
 }
 
 bool canSendTime() {
     const uint32_t ID = 0x39E;
-    uint8_t data[8] = {
-        s_input.time_hour,
-        s_input.time_minute,
-        s_input.time_second,
-        s_input.time_day,
-        (uint8_t)((s_input.time_month << 4) | 0x0F),
-        (uint8_t)s_input.time_year,
-        (uint8_t)(s_input.time_year >> 8),
-        0xF2
-    };
+    typedef CanSignal<0, 8> Hour;
+    typedef CanSignal<8, 8> Minute;
+    typedef CanSignal<16, 8> Second;
+    typedef CanSignal<24, 8> Day;
+    typedef CanSignal<36, 4> Month;
+    typedef CanSignal<40, 16> Year;
+    static uint8_t data[8] = {0, 0, 0, 0, 0x0F, 0, 0, 0xF2};
+
+    if (timeCache.refresh()) {
+        Hour::put(data, s_input.time_hour);
+        Minute::put(data, s_input.time_minute);
+        Second::put(data, s_input.time_second);
+        Day::put(data, s_input.time_day);
+        Month::put(data, s_input.time_month);
+        Year::put(data, s_input.time_year);
+    }
     canSend(ID, data);
     return true;
 }
@@ -342,16 +502,14 @@ bool canSendDmeStatus() {
 
 void canSendErrorLight(uint16_t light_id, bool enable) {
     const uint32_t ID = 0x592;
+    typedef CanSignal<8, 16> SymbolId;     // ErrorLightID
+    typedef CanSignal<24, 8> SymbolState;  // 0x31 on, 0x30 off
     const uint8_t ON = 0x31;
     const uint8_t OFF = 0x30;
 
-    uint8_t frame[] = {
-        0x40,
-        static_cast<uint8_t>(light_id & 0xFF),
-        static_cast<uint8_t>((light_id >> 8) & 0xFF),
-        enable ? ON : OFF,
-        0xFF, 0xFF, 0xFF, 0xFF
-    };
+    uint8_t frame[] = {0x40, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF};
+    SymbolId::put(frame, light_id);
+    SymbolState::put(frame, enable ? ON : OFF);
     canSend(ID, frame);
 }
 
@@ -362,95 +520,80 @@ bool canSuppressService() {
 
 bool canSuppressSos() {
     const uint32_t ID = 0x0C1;
-    uint8_t frame[8] = { (uint8_t)rand(), 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
-    canSend(ID, frame);
+    uint8_t frame[2] = { (uint8_t)rand(), 0xFF };
+    canSend(ID, frame, sizeof(frame));
     return true;
 }
 
 bool canSendGearboxData() {
     const uint32_t ID = 0x1D2;
+    typedef CanSignal<24, 4> Status;
+    typedef CanCounter<28, 4> Counter;
+    static uint8_t frame[6] = {0xE1, 0x0F, 0xFF, 0x0C, 0xF0, 0xFF};
 
-    // Byte 0 – Automatic gear
-    uint8_t byte0 = 0x00;
-    switch (s_input.currentGear) {
-        case PARK:    byte0 = 0xE1; break;
-        case REVERSE: byte0 = 0xD2; break;
-        case NEUTRAL: byte0 = 0xB4; break;
-        case DRIVE:   byte0 = 0x78; break;
-    }
+    // Byte 3 – Counter with high nibble cycling, low nibble fixed
+    static uint8_t counter_cycle = 16;
+
+    if (gearboxCache.refresh()) {
+        // Byte 0 – Automatic gear
+        switch (s_input.currentGear) {
+            case PARK:    frame[0] = 0xE1; break;
+            case REVERSE: frame[0] = 0xD2; break;
+            case NEUTRAL: frame[0] = 0xB4; break;
+            case DRIVE:   frame[0] = 0x78; break;
+        }
 
-    // Byte 1 – Explicit gear selection like "D1", "S1" or "M1" depending on the mode
-    uint8_t byte1 = 0x0F;
-    if (s_input.explicitGear != NONE
+        // Byte 1 – Explicit gear selection like "D1", "S1" or "M1" depending on the mode
+        frame[1] = 0x0F;
+        if (s_input.explicitGear != NONE
 #if !defined(GEAR_EXPLICIT_NUMBER_IN_SPORT)
-        && s_input.mode != SPORT
+            && s_input.mode != SPORT
 #endif
-    ) {
-        switch (s_input.explicitGear) {
-            case M1: byte1 = 0x50; break;
-            case M2: byte1 = 0x60; break;
-            case M3: byte1 = 0x70; break;
-            case M4: byte1 = 0x80; break;
-            case M5: byte1 = 0x90; break;
-            case M6: byte1 = 0xA0; break;
-            case M7: byte1 = 0xB0; break;
-            default: byte1 = 0x00; break;
+        ) {
+            switch (s_input.explicitGear) {
+                case M1: frame[1] = 0x50; break;
+                case M2: frame[1] = 0x60; break;
+                case M3: frame[1] = 0x70; break;
+                case M4: frame[1] = 0x80; break;
+                case M5: frame[1] = 0x90; break;
+                case M6: frame[1] = 0xA0; break;
+                case M7: frame[1] = 0xB0; break;
+                default: frame[1] = 0x00; break;
+            }
         }
-    }
-
-    // Byte 3 – Counter with high nibble cycling, low nibble fixed
-    static uint8_t counter_high = 0;
-    uint8_t byte3;
 
-    if (s_input.currentGear == PARK || s_input.currentGear == REVERSE) {
-        byte3 = (counter_high << 4) | 0x0C; // 0x0C to 0xFC
-        counter_high = (counter_high + 1) % 16;
-    } else {
-        uint8_t sport =
+        if (s_input.currentGear == PARK || s_input.currentGear == REVERSE) {
+            Status::put(frame, 0x0C); // 0x0C to 0xFC
+            counter_cycle = 16;
+        } else {
+            Status::put(frame,
  #if defined(GEAR_SPORT_TEXT)
-            // 0x07 shows text "SPORT" on the cluster in sport mode
-            s_input.mode == NORMAL ? 0x0D : 0x07;
+                // 0x07 shows text "SPORT" on the cluster in sport mode
+                s_input.mode == NORMAL ? 0x0D : 0x07
  #else
-            0x0D;
+                0x0D
  #endif
+            );
+            counter_cycle = 15;
+        }
 
-        byte3 = (counter_high << 4) | sport;
-        counter_high = (counter_high + 1) % 15;
-    }
-
-    uint8_t byte4 = 0xF0; // "D"
+        // Byte 4 – "D" by default
+        frame[4] = 0xF0;
 
-    if (s_input.mode == SPORT) {
+        if (s_input.mode == SPORT) {
 #if defined(GEAR_SPORT_S)
-        byte4 = 0xF1; // "S"
+            frame[4] = 0xF1; // "S"
 #endif
-    } else if (s_input.explicitGear != NONE) {
-        byte4 = 0xF2; // "M" in manual mode
+        } else if (s_input.explicitGear != NONE) {
+            frame[4] = 0xF2; // "M" in manual mode
+        }
     }
 
-    uint8_t frame[8] = {
-        byte0, byte1, 0xFF, byte3, byte4, 0xFF, 0xFF, 0xFF
-    };
-
-    canSend(ID, frame);
+    canSend(ID, frame, sizeof(frame));
+    Counter::next(frame, counter_cycle);
     return true;
 }
 
-#define DEFINE_CAN_SEND_SYMBOL(fn_name, signal_expr, symbol_const, interval, offset) \
-    bool fn_name() {                                                                 \
-        static bool last_value = false;                                              \
-        static uint8_t counter = offset;                                             \
-        bool value = (signal_expr) && (s_input.ignition >= IG_ON);                   \
-        counter++;                                                                   \
-        if (value != last_value || (counter % (interval) == 0)) {                    \
-            last_value = value;                                                      \
-            counter = 0;                                                             \
-            canSendErrorLight(symbol_const, value);                                  \
-            return true;                                                             \
-        }                                                                            \
-        return false;                                                                \
-    }
-
 bool shouldShowDoorOpenLeftWarning() {
     return s_input.currentGear != PARK && (
         s_input.doors.fl_open ||
@@ -465,70 +608,186 @@ bool shouldShowDoorOpenRightWarning() {
     );
 }
 
-// Interval = 200 ms
-DEFINE_CAN_SEND_SYMBOL(canSendEngineTempYellowSymbol, s_input.engine_temp_yellow && !s_input.engine_temp_red, OVERHEAT_YELLOW, 25, 0)
-DEFINE_CAN_SEND_SYMBOL(canSendEngineTempRedSymbol, s_input.engine_temp_red, OVERHEAT_RED, 25, 1)
-DEFINE_CAN_SEND_SYMBOL(canSendCheckEngineSymbol, s_input.check_engine, CHECK_ENGINE_DOUBLE, 25, 2)
-DEFINE_CAN_SEND_SYMBOL(canSendClutchTempSymbol, s_input.clutch_temp, GEARBOX_TEMP_YELLOW, 25, 3)
-DEFINE_CAN_SEND_SYMBOL(canSendOilWarningSymbol, s_input.oil_warn, OIL_RED, 25, 4)
-DEFINE_CAN_SEND_SYMBOL(canSendBatteryWarningSymbol, s_input.battery_warn , BATTERY_RED, 25, 5)
-DEFINE_CAN_SEND_SYMBOL(canSendBrakeTempSymbol, s_input.brake_temp, BRAKES_HOT, 25, 6)
-DEFINE_CAN_SEND_SYMBOL(canSendTireDeflatedFl, s_input.tires.fl_deflated, LOW_TIRE_PRESSURE_FRONT_LEFT, 25, 7)
-DEFINE_CAN_SEND_SYMBOL(canSendTireDeflatedFr, s_input.tires.fr_deflated, LOW_TIRE_PRESSURE_FRONT_RIGHT, 25, 8)
-DEFINE_CAN_SEND_SYMBOL(canSendTireDeflatedRl, s_input.tires.rl_deflated, LOW_TIRE_PRESSURE_REAR_LEFT, 25, 9)
-DEFINE_CAN_SEND_SYMBOL(canSendTireDeflatedRr, s_input.tires.rr_deflated, LOW_TIRE_PRESSURE_REAR_RIGHT, 25, 10)
-DEFINE_CAN_SEND_SYMBOL(canSendTireDeflatedAll, s_input.tires.all_deflated, LOW_TIRE_PRESSURE_ALL, 25, 11)
-DEFINE_CAN_SEND_SYMBOL(canSendRadiatorSymbol, s_input.radiator_warn, COOLANT_LOW, 25, 12)
-DEFINE_CAN_SEND_SYMBOL(canSendDoorOpenLeft, shouldShowDoorOpenLeftWarning(), DOOR_OPEN_LEFT, 25, 13)
-DEFINE_CAN_SEND_SYMBOL(canSendDoorOpenRight, shouldShowDoorOpenRightWarning(), DOOR_OPEN_RIGHT, 25, 14)
-DEFINE_CAN_SEND_SYMBOL(canSendTailgateOpen, s_input.doors.tailgate_open, BOOT_OPEN, 25, 15)
-DEFINE_CAN_SEND_SYMBOL(canSendEscDisabledSymbol, s_input.light_esc_disabled, DSC_TRIANGLE_DOUBLE, 25, 16)
-DEFINE_CAN_SEND_SYMBOL(canSendBeaconSymbol, s_input.light_beacon, ALARM_LIGHT, 25, 17)
-DEFINE_CAN_SEND_SYMBOL(canSendYellowTriangle, s_input.yellow_triangle, YELLOW_TRIANGLE, 25, 18)
-DEFINE_CAN_SEND_SYMBOL(canSendRedTriangle, s_input.red_triangle, RED_TRIANGLE, 25, 19)
-DEFINE_CAN_SEND_SYMBOL(canSendGearIssue, s_input.gear_issue, GEARBOX_ISSUE_YELLOW, 25, 20)
-DEFINE_CAN_SEND_SYMBOL(canSendExclamationMark, s_input.exclamation_mark, EXCLAMATION_MARK_YELLOW, 25, 21)
-DEFINE_CAN_SEND_SYMBOL(canSendAdblueLow, s_input.adblue_low, ADBLUE_REFILL_YELLOW, 25, 22)
-DEFINE_CAN_SEND_SYMBOL(canSendCheckeredFlag, s_input.checkered_flag, CHECKERED_FLAG, 25, 23)
-DEFINE_CAN_SEND_SYMBOL(canSendLimitYellow, s_input.limit_yellow, LIMIT_YELLOW, 25, 24)
-DEFINE_CAN_SEND_SYMBOL(canSendLimitRed, s_input.limit_red, LIMIT_RED, 25, 25)
-
-// Interval = 50 ms
-DEFINE_CAN_SEND_SYMBOL(canSendTcSymbol, s_input.light_tc_active || s_input.light_tc_disabled, DTC_SYMBOL_ONLY, 100, 1)
-DEFINE_CAN_SEND_SYMBOL(canSendEscSymbol, s_input.light_esc_active, DSC_TRIANGLE_SYMBOL_ONLY, 100, 2)
-
-bool canSendCustomSymbol() {
-    static bool last_state = false;
-    static uint16_t last_number = 0;
-    static uint8_t counter = 0;
-    const bool changed = s_input.custom_light != last_number || last_state != s_input.custom_light_on;
-
-    if (changed || (++counter % 10 == 0)) {
-        last_state = s_input.custom_light_on;
-        last_number = s_input.custom_light;
-        counter = 0;
-        canSendErrorLight(last_number, last_state);
+// Check-control symbols shown from the inputs while the ignition is on
+#define CHECK_CONTROL_SYMBOLS(X)                                                         \
+    X(OVERHEAT_YELLOW,               s_input.engine_temp_yellow && !s_input.engine_temp_red) \
+    X(OVERHEAT_RED,                  s_input.engine_temp_red)                            \
+    X(CHECK_ENGINE_DOUBLE,           s_input.check_engine)                               \
+    X(GEARBOX_TEMP_YELLOW,           s_input.clutch_temp)                                \
+    X(OIL_RED,                       s_input.oil_warn)                                   \
+    X(BATTERY_RED,                   s_input.battery_warn)                               \
+    X(BRAKES_HOT,                    s_input.brake_temp)                                 \
+    X(LOW_TIRE_PRESSURE_FRONT_LEFT,  s_input.tires.fl_deflated)                          \
+    X(LOW_TIRE_PRESSURE_FRONT_RIGHT, s_input.tires.fr_deflated)                          \
+    X(LOW_TIRE_PRESSURE_REAR_LEFT,   s_input.tires.rl_deflated)                          \
+    X(LOW_TIRE_PRESSURE_REAR_RIGHT,  s_input.tires.rr_deflated)                          \
+    X(LOW_TIRE_PRESSURE_ALL,         s_input.tires.all_deflated)                         \
+    X(COOLANT_LOW,                   s_input.radiator_warn)                              \
+    X(DOOR_OPEN_LEFT,                shouldShowDoorOpenLeftWarning())                    \
+    X(DOOR_OPEN_RIGHT,               shouldShowDoorOpenRightWarning())                   \
+    X(BOOT_OPEN,                     s_input.doors.tailgate_open)                        \
+    X(DSC_TRIANGLE_DOUBLE,           s_input.light_esc_disabled)                         \
+    X(ALARM_LIGHT,                   s_input.light_beacon)                               \
+    X(YELLOW_TRIANGLE,               s_input.yellow_triangle)                            \
+    X(RED_TRIANGLE,                  s_input.red_triangle)                               \
+    X(GEARBOX_ISSUE_YELLOW,          s_input.gear_issue)                                 \
+    X(EXCLAMATION_MARK_YELLOW,       s_input.exclamation_mark)                           \
+    X(ADBLUE_REFILL_YELLOW,          s_input.adblue_low)                                 \
+    X(CHECKERED_FLAG,                s_input.checkered_flag)                             \
+    X(LIMIT_YELLOW,                  s_input.limit_yellow)                               \
+    X(LIMIT_RED,                     s_input.limit_red)                                  \
+    X(DTC_SYMBOL_ONLY,               s_input.light_tc_active || s_input.light_tc_disabled) \
+    X(DSC_TRIANGLE_SYMBOL_ONLY,      s_input.light_esc_active)
+
+#define CHECK_CONTROL_ID(id, signal_expr) id,
+const uint16_t checkControlIds[] PROGMEM = { CHECK_CONTROL_SYMBOLS(CHECK_CONTROL_ID) };
+#undef CHECK_CONTROL_ID
+
+const uint8_t CHECK_CONTROL_COUNT = sizeof(checkControlIds) / sizeof(checkControlIds[0]);
+static_assert(CHECK_CONTROL_COUNT <= 32, "Check-control states must fit the bitset");
+
+// Bit n is the wanted state of checkControlIds[n]
+uint32_t checkControlStates() {
+    uint32_t states = 0;
+    uint32_t bit = 1;
+
+    if (s_input.ignition >= IG_ON) {
+#define CHECK_CONTROL_STATE(id, signal_expr) if (signal_expr) states |= bit; bit <<= 1;
+        CHECK_CONTROL_SYMBOLS(CHECK_CONTROL_STATE)
+#undef CHECK_CONTROL_STATE
+    }
+
+    return states;
+}
+
+// Index of the ID in the list or count if it is not there
+uint8_t findLight(const uint16_t* ids, uint8_t count, uint16_t id) {
+    uint8_t i = 0;
+    while (i < count && ids[i] != id) {
+        i++;
+    }
+    return i;
+}
+
+// What the cluster was last told, shared by the check-control tasks
+static uint32_t checkControlSent = 0;
+static uint16_t customLightsSent[CUSTOM_LIGHTS_MAX];
+static uint8_t customLightsSentCount = 0;
+
+/*
+    Sends one check-control symbol whose state changed: the fixed ones lowest bit
+    first, then custom lights the host removed and then the ones it added. Also
+    queued on its own after canSendCheckControl(), so changes go out two per 50 ms.
+    More would make the 20 ms frames miss their deadline with USE_SPEED_HIGH_RATE.
+*/
+bool canSendCheckControlChange() {
+    uint32_t states = checkControlStates();
+    uint32_t changed = states ^ checkControlSent;
+
+    if (changed) {
+        uint8_t index = 0;
+        while (!(changed & (1UL << index))) {
+            index++;
+        }
+
+        checkControlSent ^= 1UL << index;
+        canSendErrorLight(pgm_read_word(&checkControlIds[index]), states & (1UL << index));
         return true;
     }
+
+    for (uint8_t i = 0; i < customLightsSentCount; ++i) {
+        uint16_t id = customLightsSent[i];
+        if (findLight(s_input.custom_lights, s_input.custom_light_count, id) == s_input.custom_light_count) {
+            customLightsSent[i] = customLightsSent[--customLightsSentCount];
+            canSendErrorLight(id, false);
+            return true;
+        }
+    }
+
+    for (uint8_t i = 0; i < s_input.custom_light_count; ++i) {
+        uint16_t id = s_input.custom_lights[i];
+        if (findLight(customLightsSent, customLightsSentCount, id) == customLightsSentCount) {
+            customLightsSent[customLightsSentCount++] = id;
+            canSendErrorLight(id, true);
+            return true;
+        }
+    }
+
     return false;
 }
 
+/*
+    All check-control symbols share one 0x592 frame per call. A symbol whose state
+    changed is sent first, see canSendCheckControlChange(). Otherwise the symbols
+    that are shown are refreshed round-robin, at most CHECK_CONTROL_REFRESH_FPS
+    frames per second and each at most every CHECK_CONTROL_REFRESH_MS. Symbols that
+    are off are only sent when they turn off.
+*/
+bool canSendCheckControl() {
+    const uint16_t callIntervalMs = 50;
+    const uint8_t refreshSpacing = max(1000 / callIntervalMs / CHECK_CONTROL_REFRESH_FPS, 1);
+    const uint16_t roundCalls = CHECK_CONTROL_REFRESH_MS / callIntervalMs;
+
+    static uint8_t cursor = 0xFF;
+    static uint16_t calls_since_round = 0;
+    static uint8_t calls_since_refresh = 0;
+
+    if (calls_since_round < roundCalls) calls_since_round++;
+    if (calls_since_refresh < refreshSpacing) calls_since_refresh++;
+
+    if (canSendCheckControlChange()) {
+        return true;
+    }
+
+    if (calls_since_refresh < refreshSpacing) {
+        return false;
+    }
+
+    // Fixed symbols that are shown and then every custom light
+    const uint8_t total = CHECK_CONTROL_COUNT + customLightsSentCount;
+    while (cursor < CHECK_CONTROL_COUNT && !(checkControlSent & (1UL << cursor))) {
+        cursor++;
+    }
+
+    if (cursor >= total) {
+        // The next round starts CHECK_CONTROL_REFRESH_MS after the previous one at the earliest
+        if (calls_since_round < roundCalls || (!checkControlSent && !customLightsSentCount)) {
+            return false;
+        }
+        calls_since_round = 0;
+        cursor = 0;
+        while (cursor < CHECK_CONTROL_COUNT && !(checkControlSent & (1UL << cursor))) {
+            cursor++;
+        }
+    }
+
+    calls_since_refresh = 0;
+    canSendErrorLight(cursor < CHECK_CONTROL_COUNT ? pgm_read_word(&checkControlIds[cursor])
+                                                   : customLightsSent[cursor - CHECK_CONTROL_COUNT], true);
+    cursor++;
+    return true;
+}
+
 bool canSendOilLevel() {
     const uint32_t ID = 0x381;
+    typedef CanSignal<0, 8> OilLevel;
+    typedef CanSignal<8, 8> OilLevelState;
     static uint8_t frame[8] = {0, 0, 0xFF, 0, 0, 0, 0, 0};
 
-    // below min: 0x0C
-    // min: 0x19
-    // between min and middle: 0x26
-    // middle: 0x35
-    // between middle and max: 0x45
-    // max: 0x55
-    // above max: 0x5F
-    frame[0] = s_input.oil_warn ? 0x0C : 0x35;
-    // >MAX: e.g. 0xF1
-    // OK: 0xF0
-    // +1l: 0xF2
-    frame[1] = s_input.oil_warn ? 0xF2 : 0xF0;
+    if (oilLevelCache.refresh()) {
+        // below min: 0x0C
+        // min: 0x19
+        // between min and middle: 0x26
+        // middle: 0x35
+        // between middle and max: 0x45
+        // max: 0x55
+        // above max: 0x5F
+        OilLevel::put(frame, s_input.oil_warn ? 0x0C : 0x35);
+        // >MAX: e.g. 0xF1
+        // OK: 0xF0
+        // +1l: 0xF2
+        OilLevelState::put(frame, s_input.oil_warn ? 0xF2 : 0xF0);
+    }
 
     canSend(ID, frame);
     return true;
@@ -553,46 +812,39 @@ inline uint8_t getCruiseTimer(uint16_t call_interval_ms = 100) {
 #if !defined(CAN_CRUISE_ALT)
 bool canSendCruiseControl() {
     const uint32_t ID = 0x193;
+    typedef CanSignal<0, 8> Timer;
+    typedef CanSignal<8, 8> CruiseSpeed;          // km/h, 0xFE when off
+    typedef CanSignal<16, 8> CruiseStatus;        // 0xF4 on, 0xF1 off, 0xF5 for mph
+    typedef CanSignal<28, 1> AccCarAhead;
+    typedef CanSignal<29, 1> AccFootOnBrake;
+    typedef CanSignal<32, 1> AccCarAheadBlinking;
+    typedef CanSignal<40, 3> AccDistance;         // Distance + 1, 0 without ACC
+    typedef CanSignal<43, 1> CruiseActive;
+    typedef CanSignal<48, 1> SpeedUpdate;         // Set in the first frame after a change
+    static uint8_t frame[8] = {0x00, 0xFE, 0xF1, 0x00, 0x00, 0x50, 0x00, 0x00};
 
     static uint8_t last_kmh = 0xFE;
     static bool last_enabled = false;
 
-    uint8_t kmh = s_input.cruise.enabled ? min(s_input.cruise.speed, (uint16_t)250) : 0xFE;
-    uint8_t cruise_status = s_input.cruise.enabled ? 0xF4 : 0xF1; // 0xF5 for mph!
-    uint8_t cc_flag = s_input.cruise.enabled ? 0x58 : 0x50;
-    uint8_t speed_update = (kmh != last_kmh || s_input.cruise.enabled != last_enabled) ? 0x01 : 0x00;
-    uint8_t byte3 = 0;
-    uint8_t byte4 = 0;
+    SpeedUpdate::put(frame, 0);
 
-    if (s_input.cruise.acc.distance) {
-        cc_flag |= s_input.cruise.acc.distance + 1;
-    }
+    if (cruiseCache.refresh()) {
+        uint8_t kmh = s_input.cruise.enabled ? min(s_input.cruise.speed, (uint16_t)250) : 0xFE;
 
-    if (s_input.cruise.acc.yellow_car_static) {
-        byte3 |= 0x10;
-    }
+        CruiseSpeed::put(frame, kmh);
+        CruiseStatus::put(frame, s_input.cruise.enabled ? 0xF4 : 0xF1);
+        AccCarAhead::put(frame, s_input.cruise.acc.yellow_car_static);
+        AccFootOnBrake::put(frame, s_input.cruise.acc.foot_on_brake);
+        AccCarAheadBlinking::put(frame, s_input.cruise.acc.red_car_blinking);
+        AccDistance::put(frame, s_input.cruise.acc.distance ? s_input.cruise.acc.distance + 1 : 0);
+        CruiseActive::put(frame, s_input.cruise.enabled);
+        SpeedUpdate::put(frame, kmh != last_kmh || s_input.cruise.enabled != last_enabled);
 
-    if (s_input.cruise.acc.foot_on_brake) {
-        byte3 |= 0x20;
+        last_kmh = kmh;
+        last_enabled = s_input.cruise.enabled;
     }
 
-    if (s_input.cruise.acc.red_car_blinking) {
-        byte4 |= 0x01;
-    }
-
-    last_kmh = kmh;
-    last_enabled = s_input.cruise.enabled;
-
-    uint8_t frame[8] = {
-        getCruiseTimer(100),
-        kmh,
-        cruise_status,
-        byte3,
-        byte4,
-        cc_flag,
-        speed_update,
-        0x00
-    };
+    Timer::put(frame, getCruiseTimer(100));
 
     canSend(ID, frame);
     return true;
@@ -608,28 +860,33 @@ bool canSendCruiseControl() {
 
 // CAN read
 void handle1B4(const uint8_t* data) {
-    int16_t rawHigh = (int16_t)data[1] - 192;
-    uint16_t rawLow = data[0];
-    uint16_t rawSpeed = ((uint16_t)rawHigh * 256 + rawLow);
-    uint16_t mph = rawSpeed / 16;
+    typedef CanSignal<0, 12, 1, 16> VehicleSpeed;  // mph
+    typedef CanSignal<41, 1> Handbrake;
+
+    uint16_t mph = VehicleSpeed::decode<uint16_t>(data);
 
     // Integer-based km/h conversion with rounding
     uint16_t kmh = (uint32_t)(mph * 160934 + 50000) / 100000;
 
-    const char* handbrake = (data[5] & 0x02) ? "ON" : "OFF";
+    const char* handbrake = Handbrake::get(data) ? "ON" : "OFF";
 
     serial_printf(pc, "[CAN1B4] Speed: %u km/h, Handbrake: %s\n", kmh, handbrake);
 }
 
 void handle330(const uint8_t* data) {
-    s_refueling.avgFuelFromCluster = data[3];
-    uint8_t left = data[4];
-    uint8_t right = data[5];
-    uint16_t rawRange = (data[7] << 8) | data[6];
-    uint16_t range = rawRange / 16;
+    typedef CanSignal<24, 8> AverageFuel;     // l
+    typedef CanSignal<32, 8> TankLevelLeft;
+    typedef CanSignal<40, 8> TankLevelRight;
+    typedef CanSignal<48, 16, 1, 16> Range;   // km
+
+    s_refueling.avgFuelFromCluster = AverageFuel::get(data);
+    s_refueling.tankLeft = TankLevelLeft::get(data);
+    s_refueling.tankRight = TankLevelRight::get(data);
+    s_refueling.tankReceived = true;
+    uint16_t range = Range::decode<uint16_t>(data);
 
     serial_printf(pc, "[CAN330] AvgFuel: %u L, L: %u, R: %u, Range: %u km\n",
-        s_refueling.avgFuelFromCluster, left, right, range);
+        s_refueling.avgFuelFromCluster, s_refueling.tankLeft, s_refueling.tankRight, range);
 }
 
 void handle2C0(const uint8_t* data) {
@@ -637,24 +894,37 @@ void handle2C0(const uint8_t* data) {
         data[0], data[1], data[2], data[3]);
 }
 
+#if defined(READ_FRAMES_FROM_CLUSTER_2CA) || defined(USE_AD5272_AMBIENT)
 void handle2CA(const uint8_t* data) {
-    float temp_c = (data[0] / 2.0f) - 40.0f;
+    typedef CanSignal<0, 8, 1, 2, -40> OutsideTemp;  // °C
+
+#if defined(USE_AD5272_AMBIENT)
+    // In 0.1 °C like s_input.ambient_temp
+    s_ambient.shown = OutsideTemp::get(data) * 5 - 400;
+    s_ambient.shownTime = millis();
+    s_ambient.received = true;
+#endif
+
+#ifdef READ_FRAMES_FROM_CLUSTER_2CA
+    float temp_c = OutsideTemp::decode<float>(data);
     serial_printf(pc, "[CAN2CA] Outside Temp: %.1f°C\n", temp_c);
+#endif
 }
+#endif
 
 void handle2F8(const uint8_t* data) {
-    uint8_t hour = data[0];
-    uint8_t minute = data[1];
-    uint8_t second = data[2];
-    uint8_t day = data[3];
-    uint8_t month = data[4] >> 4;
-    uint16_t year = data[5] | (data[6] << 8);
+    typedef CanSignal<0, 8> Hour;
+    typedef CanSignal<8, 8> Minute;
+    typedef CanSignal<16, 8> Second;
+    typedef CanSignal<24, 8> Day;
+    typedef CanSignal<36, 4> Month;
+    typedef CanSignal<40, 16> Year;
 
     serial_printf(pc, "[CAN2F8] Time: %02u:%02u:%02u Date: %02u.%02u.%u\n",
-        hour, minute, second, day, month, year);
+        Hour::get(data), Minute::get(data), Second::get(data), Day::get(data), Month::get(data), Year::get(data));
 }
 
-static const CanHandlerEntry handler_table[] = {
+static constexpr CanHandlerEntry handler_table[] = {
 #ifdef READ_FRAMES_FROM_CLUSTER_1B4
     { 0x1B4, handle1B4 },
 #endif
@@ -662,7 +932,7 @@ static const CanHandlerEntry handler_table[] = {
 #ifdef READ_FRAMES_FROM_CLUSTER_2C0
     { 0x2C0, handle2C0 },
 #endif
-#ifdef READ_FRAMES_FROM_CLUSTER_2CA
+#if defined(READ_FRAMES_FROM_CLUSTER_2CA) || defined(USE_AD5272_AMBIENT)
     { 0x2CA, handle2CA },
 #endif
 #ifdef READ_FRAMES_FROM_CLUSTER_2F8
@@ -670,18 +940,20 @@ static const CanHandlerEntry handler_table[] = {
 #endif
 };
 
-static const size_t handler_count = sizeof(handler_table) / sizeof(handler_table[0]);
+static constexpr size_t handler_count = sizeof(handler_table) / sizeof(handler_table[0]);
+
+// Hashed at compile time, see can_dispatch.h
+typedef CanRxTable<handler_table, handler_count> CanRx;
 
 // CAN write queue
-const int MaxQueueSize = 64;
-bool (*canQueue[MaxQueueSize])();
-int queueHead = 0;
-int queueTail = 0;
+typedef bool (*CanTask)();
+SpscRing<CanTask, 64> canQueue;
 
-bool queueIsEmpty() { return queueHead == queueTail; }
-bool queueIsFull() { return ((queueTail + 1) % MaxQueueSize) == queueHead; }
-void queuePush(bool (*f)()) { if (!queueIsFull()) { canQueue[queueTail] = f; queueTail = (queueTail + 1) % MaxQueueSize; } }
-bool (*queuePop())() { if (!queueIsEmpty()) { bool (*f)() = canQueue[queueHead]; queueHead = (queueHead + 1) % MaxQueueSize; return f; } return nullptr; }
+// A task still waiting is not queued again, it sends the latest values anyway
+void queuePush(CanTask f) { if (!canQueue.contains(f)) canQueue.push(f); }
+CanTask queuePop() { CanTask f = nullptr; canQueue.pop(f); return f; }
+
+void canService();
 
 void setup() {
 #ifdef LED_BUILTIN
@@ -690,19 +962,22 @@ void setup() {
     pinMode(REFUELING_LED_PIN, OUTPUT);
 
 #if defined(USE_SIMHUB)
-    simHubSetup();
+    simHubSetup(canService);
 #else
     pc.begin(PC_SERIAL_BAUD);
 #endif
 
-    canBegin();
+    canBegin(handler_table, handler_count);
+#if defined(USE_CAN_TIMER_TX)
+    canTimerBegin();
+#endif
 
 #if defined(USE_AD5272_AMBIENT)
     if (!ambientTemp.begin()) {
         pc.println("AD5272 ambient temp sensor init failed");
     } else {
         pc.println("AD5272 initialized successfully");
-        ambientTemp.setTemperature((float)s_input.ambient_temp / 10.f);
+        ambientTemp.setTemperature(s_input.ambient_temp);
     }
 #endif
 }
@@ -727,121 +1002,160 @@ void checkRefuelingStatus() {
 
 #if defined(USE_AD5272_AMBIENT)
 void updateAmbientTemperature() {
-    static float current_temp = (float)s_input.ambient_temp / 10.f;
-    float target_temp = (float)s_input.ambient_temp / 10.f;
-
-    // Move towards target at max 0.1°C per second
-    const float max_change = 0.1f;
-    float delta = target_temp - current_temp;
-
-    if (delta > max_change) {
-        current_temp += max_change;
-    } else if (delta < -max_change) {
-        current_temp -= max_change;
-    } else {
-        current_temp = target_temp;
+    static int16_t current_temp = s_input.ambient_temp;
+
+    // 0x2CA is sent every few seconds, without it fall back to the open loop
+    const uint32_t READBACK_TIMEOUT_MS = 10000;
+    // The cluster reports 0.5 °C steps
+    const int16_t SETTLED_BAND = 5;
+
+    if (s_ambient.received && millis() - s_ambient.shownTime < READBACK_TIMEOUT_MS) {
+        // The cluster filters the sensor heavily, so drive it past the target by the error that
+        // is left. The overshoot shrinks as the shown value converges and is gone once it settles.
+        int16_t error = s_input.ambient_temp - s_ambient.shown;
+        if (abs(error) <= SETTLED_BAND) {
+            error = 0;
+        }
+        int16_t lead = constrain(error * AD5272_FEEDBACK_GAIN, -AD5272_MAX_OVERSHOOT, AD5272_MAX_OVERSHOOT);
+        current_temp = s_input.ambient_temp + lead;
+    } else if (s_input.ambient_temp > current_temp) {
+        // Move towards target at max 0.1°C per second
+        current_temp++;
+    } else if (s_input.ambient_temp < current_temp) {
+        current_temp--;
     }
 
     ambientTemp.setTemperature(current_temp);
 }
 #endif
 
-void loop() {
+// One 10 ms scheduler tick: queues the frames that are due
+void canTick() {
+#if defined(USE_SPEED_HIGH_RATE)
+    // Send every SPEED_HIGH_RATE_MS, first so the busy ticks do not delay it
+    if (s_timers.canCounter % (SPEED_HIGH_RATE_MS / 10) == 0) {
+        queuePush(canSendSpeed);
+    }
+#endif
+    // Every 10 ms, the RPM is sent at most every 20 ms and only every 50 ms while steady, ahead of the
+    // busy ticks so they do not delay it
+    queuePush(canSendRPM);
+    // Send every 100 ms
+    if (s_timers.canCounter % 10 == 0) {
+        queuePush(canSendIgnitionFrame);
+        queuePush(canSendEngineTempAndFuelInjection);
+        queuePush(canSendGearboxData);
+        queuePush(canSendSteeringWheel);
+        queuePush(canSendDmeStatus);
+        queuePush(canSendCruiseControl);
+        queuePush(canSendVehicleDynamics);
+    }
+    // Send every 50 ms, the speed only while it changes and up to 2 check-control changes
+    if (s_timers.canCounter % 5 == 1) {
+#if !defined(USE_SPEED_HIGH_RATE)
+        queuePush(canSendSpeed);
+#endif
+        queuePush(canSendCheckControl);
+        queuePush(canSendCheckControlChange);
+    }
+    // Send every 200 ms (group 1)
+    if (s_timers.canCounter % 20 == 7) {
+        queuePush(canSendLights);
+        queuePush(canSendIndicator);
+        queuePush(canSendAbs);
+        queuePush(canSendAbsCounter);
+        queuePush(canSendAirbagCounter);
+        queuePush(canSendFuel);
+        queuePush(canSendHandbrake);
+    }
+    // Send every 500 ms
+    if (s_timers.canCounter % 50 == 5) {
+        queuePush(canSuppressSos);
+        queuePush(canSuppressService);
+    }
+    // Send every 1 s
+    if (s_timers.canCounter % 100 == 35) {
+        queuePush(canSendTime);
+        checkRefuelingStatus();
+#if defined(USE_AD5272_AMBIENT)
+        updateAmbientTemperature();
+#endif
+    }
+    // Send every 10 s
+    if (s_timers.canCounter % 1000 == 47) {
+        queuePush(canSendOilLevel);
+    }
+
+    s_timers.canCounter++;
+}
+
+// Everything that keeps the cluster alive. Also run from SimHub's idle hook while
+// it waits for the rest of a command so CAN is never starved by the serial link
+void canService() {
     uint32_t now_us = micros();
     uint32_t now_ms = now_us / 1000;
 
+#if defined(USE_CAN_TIMER_TX)
+    (void)now_ms;  // Only the optional services below need the time then
+
+    // The timer counts the ticks, the ones the loop was too busy for are caught up here. A task
+    // is only queued once however many of its periods were missed, and after a stall of more
+    // than 1 s the rest of the ticks are dropped so the 1 s group runs at most once too.
+    uint32_t ticks = canTimerTakeTicks();
+    for (ticks = min(ticks, (uint32_t)100); ticks > 0; --ticks) {
+        canTick();
+    }
+
+    // Frames are built as soon as the timer's queue has room and sent by the timer 3 ms apart.
+    // Tasks that send nothing do not take a slot.
+    if (!canTimerQueueFull()) {
+        inputCacheUpdate(s_input);
+
+        CanTask task;
+        while (!canTimerQueueFull() && (task = queuePop())) {
+            task();
+        }
+    }
+#else
     // Main loop is executed every 10 ms
     if (now_ms - s_timers.lastTime >= 10) {
         s_timers.lastTime = now_ms;
-
-        // Send every 100 ms
-        if (s_timers.canCounter % 10 == 0) {
-            queuePush(canSendIgnitionFrame);
-            queuePush(canSendEngineTempAndFuelInjection);
-            queuePush(canSendGearboxData);
-            queuePush(canSendSteeringWheel);
-            queuePush(canSendDmeStatus);
-            queuePush(canSendCruiseControl);
-            queuePush(canSendVehicleDynamics);
-            queuePush(canSendSpeed);
-        }
-        // Send every 50 ms
-        if (s_timers.canCounter % 5 == 1) {
-            queuePush(canSendRPM);
-            queuePush(canSendTcSymbol);
-            queuePush(canSendEscSymbol);
-        }
-        // Send every 200 ms (group 1)
-        if (s_timers.canCounter % 20 == 7) {
-            queuePush(canSendLights);
-            queuePush(canSendIndicator);
-            queuePush(canSendAbs);
-            queuePush(canSendAbsCounter);
-            queuePush(canSendAirbagCounter);
-            queuePush(canSendFuel);
-            queuePush(canSendHandbrake);
-        }
-        // Send every 200 ms (symbols)
-        if (s_timers.canCounter % 20 == 13) {
-            queuePush(canSendEngineTempYellowSymbol);
-            queuePush(canSendEngineTempRedSymbol);
-            queuePush(canSendCheckEngineSymbol);
-            queuePush(canSendClutchTempSymbol);
-            queuePush(canSendOilWarningSymbol);
-            queuePush(canSendBatteryWarningSymbol);
-            queuePush(canSendCustomSymbol);
-            queuePush(canSendBrakeTempSymbol);
-            queuePush(canSendTireDeflatedFl);
-            queuePush(canSendTireDeflatedFr);
-            queuePush(canSendTireDeflatedRl);
-            queuePush(canSendTireDeflatedRr);
-            queuePush(canSendTireDeflatedAll);
-            queuePush(canSendRadiatorSymbol);
-            queuePush(canSendDoorOpenLeft);
-            queuePush(canSendDoorOpenRight);
-            queuePush(canSendTailgateOpen);
-            queuePush(canSendEscDisabledSymbol);
-            queuePush(canSendBeaconSymbol);
-            queuePush(canSendYellowTriangle);
-            queuePush(canSendRedTriangle);
-            queuePush(canSendGearIssue);
-            queuePush(canSendExclamationMark);
-            queuePush(canSendAdblueLow);
-            queuePush(canSendCheckeredFlag);
-            queuePush(canSendLimitYellow);
-            queuePush(canSendLimitRed);
-        }
-        // Send every 500 ms
-        if (s_timers.canCounter % 50 == 5) {
-            queuePush(canSuppressSos);
-            queuePush(canSuppressService);
-        }
-        // Send every 1 s
-        if (s_timers.canCounter % 100 == 35) {
-            queuePush(canSendTime);
-            checkRefuelingStatus();
-#if defined(USE_AD5272_AMBIENT)
-            updateAmbientTemperature();
-#endif
-        }
-        // Send every 10 s
-        if (s_timers.canCounter % 1000 == 47) {
-            queuePush(canSendOilLevel);
-        }
-
-        s_timers.canCounter++;
+        canTick();
     }
 
     // Allow 3 ms time for the serial CAN bus to transmit the frame. With 115200 baud
     // rate to Serial CAN bus and 100 kbs CAN bus this should be enough but 1-2 ms isn't
     if (now_us - s_timers.lastTaskTime >= 3000) {
-        bool (*task)() = queuePop();
+        // Frames whose inputs have changed since are re-encoded when sent
+        inputCacheUpdate(s_input);
+
+        CanTask task = queuePop();
         if (task && task()) {
             // Many of the functions do not send a CAN frame every time they are called (e.g. the ones that only update when the value changes)
             // so only update the task time if a frame was actually sent to avoid blocking the sending with NOOP tasks in the queue
             s_timers.lastTaskTime = now_us;
         }
     }
+#endif
+
+    canPoll(CanRx::dispatch);
+
+#if defined(USE_AD5272_AMBIENT)
+    // At most one short I2C write, queued by updateAmbientTemperature()
+    ambientTemp.service(now_ms);
+#endif
+
+#if defined(USE_FUEL_CALIBRATION)
+    fuelCalibrationUpdate(now_ms);
+#endif
+
+#if defined(USE_CAN_STATS)
+    canStatsUpdate(now_ms);
+#endif
+}
+
+void loop() {
+    canService();
 
 #if defined(USE_SIMHUB)
     simHubSerialRead();
@@ -849,6 +1163,4 @@ void loop() {
     serialRead();
     serialParse();
 #endif
-
-    canPoll(handler_table, handler_count);
 }
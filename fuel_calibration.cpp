@@ -0,0 +1,227 @@
+#include "fuel_calibration.h"
+
+#if defined(USE_FUEL_CALIBRATION)
+
+#include <Arduino.h>
+#include "types.h"
+#include "serial.h"
+#include "pc_printf.h"
+
+#define FUEL_CAL_TABLE_CHUNK 7  // Points that fit the 32 byte payload after the header
+
+extern SRefueling s_refueling;
+extern FuelTable fuelTableLeft;
+extern FuelTable fuelTableRight;
+
+struct FuelCalibrationSample {
+    uint16_t level;  // Sent to both sensors
+    uint8_t left;    // Readings in 0x330
+    uint8_t right;
+    uint8_t fuel;
+    bool settled;    // False if FUEL_CALIBRATION_TIMEOUT_MS ran out first
+};
+
+static FuelCalibrationSample samples[FUEL_CALIBRATION_MAX_SAMPLES];
+static uint8_t sample_count = 0;
+
+static bool sweeping = false;
+static bool step_started = false;
+static uint16_t sweep_from = 0;
+static uint16_t sweep_to = 0;
+static uint8_t sweep_steps = 0;
+static uint32_t step_start_ms = 0;
+static uint32_t change_ms = 0;
+static uint8_t seen_left = 0;
+static uint8_t seen_right = 0;
+static uint8_t seen_fuel = 0;
+
+// A curve arrives in chunks and is only used when complete and valid
+static FuelLevelPoint staging[FUEL_TABLE_MAX_POINTS];
+static uint8_t staging_side = 0xFF;
+static uint8_t staging_next = 0;
+static bool table_changed = false;
+
+static inline uint16_t parse_u16(const uint8_t* p) {
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint16_t sweepLevel(uint8_t step) {
+    return sweep_from + ((int32_t)sweep_to - sweep_from) * step / (sweep_steps - 1);
+}
+
+static void printSample(uint8_t i) {
+    const FuelCalibrationSample& s = samples[i];
+    serial_printf(pc, "[FUELCAL] sample %u level %u left %u right %u fuel %u %s\n",
+        i, s.level, s.left, s.right, s.fuel, s.settled ? "settled" : "timeout");
+}
+
+static void loadTableChunk(const uint8_t* p) {
+    uint8_t side = p[0];
+    uint8_t first = p[1];
+    uint8_t count = p[2];
+    uint8_t total = p[3];
+
+    if (side > 1 || count > FUEL_CAL_TABLE_CHUNK || total < 2 || total > FUEL_TABLE_MAX_POINTS || first + count > total) {
+        serial_printf(pc, "[FUELCAL] table rejected: at most %u points\n", FUEL_TABLE_MAX_POINTS);
+        staging_side = 0xFF;
+        return;
+    }
+
+    if (first == 0) {
+        staging_side = side;
+        staging_next = 0;
+    }
+
+    if (side != staging_side || first != staging_next) {
+        serial_printf(pc, "[FUELCAL] table rejected: chunk out of order\n");
+        staging_side = 0xFF;
+        return;
+    }
+
+    for (uint8_t i = 0; i < count; ++i) {
+        staging[first + i].fuel = parse_u16(&p[4 + i * 4]);
+        staging[first + i].meter_level = parse_u16(&p[6 + i * 4]);
+    }
+
+    staging_next = first + count;
+    if (staging_next < total) {
+        return;
+    }
+
+    staging_side = 0xFF;
+
+    // interpolateFuel() walks from full to empty
+    bool valid = staging[0].fuel == FUEL_FULL && staging[total - 1].fuel == 0;
+    for (uint8_t i = 0; valid && i < total - 1; ++i) {
+        valid = staging[i].fuel > staging[i + 1].fuel;
+    }
+
+    if (!valid) {
+        serial_printf(pc, "[FUELCAL] table rejected: fuel must fall from %u to 0\n", FUEL_FULL);
+        return;
+    }
+
+    for (uint8_t i = 0; i < total; ++i) {
+        if (staging[i].meter_level > FUEL_METER_LEVEL_MAX) {
+            serial_printf(pc, "[FUELCAL] table rejected: levels 0 to %u\n", FUEL_METER_LEVEL_MAX);
+            return;
+        }
+    }
+
+    FuelTable& table = side ? fuelTableRight : fuelTableLeft;
+    for (uint8_t i = 0; i < total; ++i) {
+        table.points[i] = staging[i];
+    }
+    table.size = total;
+    table_changed = true;
+
+    serial_printf(pc, "[FUELCAL] %s curve loaded, %u points\n", side ? "right" : "left", total);
+}
+
+void fuelCalibrationCommand(const uint8_t* command) {
+    const uint8_t* p = command + 1;
+
+    if (command[0] == FUEL_CAL_SWEEP) {
+        uint8_t steps = p[4];
+        if (steps < 2 || steps > FUEL_CALIBRATION_MAX_SAMPLES) {
+            serial_printf(pc, "[FUELCAL] sweep rejected: 2 to %u steps\n", FUEL_CALIBRATION_MAX_SAMPLES);
+            return;
+        }
+        if (!s_refueling.tankReceived) {
+            serial_printf(pc, "[FUELCAL] sweep rejected: no 0x330 from the cluster\n");
+            return;
+        }
+
+        uint16_t from = parse_u16(&p[0]);
+        uint16_t to = parse_u16(&p[2]);
+        if (from > FUEL_METER_LEVEL_MAX || to > FUEL_METER_LEVEL_MAX) {
+            serial_printf(pc, "[FUELCAL] sweep rejected: levels 0 to %u\n", FUEL_METER_LEVEL_MAX);
+            return;
+        }
+
+        sweep_from = from;
+        sweep_to = to;
+        sweep_steps = steps;
+        sample_count = 0;
+        step_started = false;
+        sweeping = true;
+
+        serial_printf(pc, "[FUELCAL] sweep %u to %u in %u steps\n", sweep_from, sweep_to, sweep_steps);
+    } else if (command[0] == FUEL_CAL_STOP) {
+        if (sweeping) {
+            sweeping = false;
+            serial_printf(pc, "[FUELCAL] stopped after %u samples\n", sample_count);
+        }
+    } else if (command[0] == FUEL_CAL_DUMP) {
+        for (uint8_t i = 0; i < sample_count; ++i) {
+            printSample(i);
+        }
+        serial_printf(pc, "[FUELCAL] done %u\n", sample_count);
+    } else if (command[0] == FUEL_CAL_TABLE) {
+        loadTableChunk(p);
+    } else {
+        serial_printf(pc, "[FUELCAL] unknown command %u\n", command[0]);
+    }
+}
+
+void fuelCalibrationUpdate(uint32_t now_ms) {
+    if (!sweeping) {
+        return;
+    }
+
+    if (!step_started) {
+        step_started = true;
+        step_start_ms = now_ms;
+        change_ms = now_ms;
+        seen_left = s_refueling.tankLeft;
+        seen_right = s_refueling.tankRight;
+        seen_fuel = s_refueling.avgFuelFromCluster;
+        return;
+    }
+
+    if (s_refueling.tankLeft != seen_left || s_refueling.tankRight != seen_right ||
+        s_refueling.avgFuelFromCluster != seen_fuel) {
+        seen_left = s_refueling.tankLeft;
+        seen_right = s_refueling.tankRight;
+        seen_fuel = s_refueling.avgFuelFromCluster;
+        change_ms = now_ms;
+    }
+
+    // The cluster filters the level heavily, a step is done once its readings stop moving
+    bool settled = now_ms - change_ms >= FUEL_CALIBRATION_SETTLE_MS;
+    if (!settled && now_ms - step_start_ms < FUEL_CALIBRATION_TIMEOUT_MS) {
+        return;
+    }
+
+    FuelCalibrationSample& sample = samples[sample_count];
+    sample.level = sweepLevel(sample_count);
+    sample.left = seen_left;
+    sample.right = seen_right;
+    sample.fuel = seen_fuel;
+    sample.settled = settled;
+    printSample(sample_count);
+
+    if (++sample_count == sweep_steps) {
+        sweeping = false;
+        serial_printf(pc, "[FUELCAL] done %u\n", sample_count);
+    } else {
+        step_started = false;
+    }
+}
+
+bool fuelCalibrationLevels(uint16_t& left, uint16_t& right) {
+    if (!sweeping) {
+        return false;
+    }
+
+    left = right = sweepLevel(sample_count);
+    return true;
+}
+
+bool fuelCalibrationTableChanged() {
+    bool changed = table_changed;
+    table_changed = false;
+    return changed;
+}
+
+#endif // USE_FUEL_CALIBRATION
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "config.h"
+#include <stdint.h>
+
+#if defined(USE_FUEL_CALIBRATION)
+
+#if defined(USE_SIMHUB)
+    #error "USE_FUEL_CALIBRATION needs the custom binary API"
+#endif
+
+/*
+    Fuel gauge calibration
+
+    A sweep steps both 0x349 sensor levels from one value to another. After each
+    step it waits until the tank readings and fuel amount the cluster reports in
+    0x330 have not changed for FUEL_CALIBRATION_SETTLE_MS, records them and
+    prints a [FUELCAL] line. tools/fuel_calibrate.py runs the sweep, fits a curve
+    to the samples and loads it back into fuelTableLeft and fuelTableRight. A
+    loaded curve lasts until the next reset, paste the printed one into the
+    sketch to keep it.
+
+    The host sends 'C' frames, the same length and checksum as the 'S' frame:
+
+    | Offset | Size | Field      |
+    |--------|------|------------|
+    | 0      | 1    | `'C'`      |
+    | 1      | 1    | command    |
+    | 2      | 32   | payload    |
+    | 34     | 1    | checksum   |
+
+    FUEL_CAL_SWEEP    from (u16), to (u16, both up to FUEL_METER_LEVEL_MAX), steps (u8, 2 to
+                      FUEL_CALIBRATION_MAX_SAMPLES)
+    FUEL_CAL_STOP     -
+    FUEL_CAL_DUMP     - prints the recorded samples again
+    FUEL_CAL_TABLE    side (u8, 0 = left, 1 = right), first (u8), count (u8, max 7), total (u8),
+                      count times fuel (u16, per mille) and meter level (u16, up to
+                      FUEL_METER_LEVEL_MAX). The curve is
+                      used once the last chunk has arrived, from full to empty.
+*/
+
+enum FUEL_CAL_COMMAND {
+    FUEL_CAL_SWEEP = 1,
+    FUEL_CAL_STOP = 2,
+    FUEL_CAL_DUMP = 3,
+    FUEL_CAL_TABLE = 4
+};
+
+#define FUEL_CAL_FRAME_START 'C'
+
+// Command byte and payload of a 'C' frame whose checksum has been checked
+void fuelCalibrationCommand(const uint8_t* command);
+
+// Steps the sweep, called from canService()
+void fuelCalibrationUpdate(uint32_t now_ms);
+
+// Levels to send in 0x349 instead of the gauge curve while a sweep runs
+bool fuelCalibrationLevels(uint16_t& left, uint16_t& right);
+
+// True once after a new curve has been loaded
+bool fuelCalibrationTableChanged();
+
+#endif
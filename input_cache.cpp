@@ -0,0 +1,20 @@
+#include "input_cache.h"
+
+// Constant initialised so it is valid before any cache constructor runs
+static InputCache* caches = nullptr;
+
+InputCache::InputCache(uint32_t reads) : reads(reads), stale(true), next(caches) {
+    caches = this;
+}
+
+void inputCacheUpdate(SInput& input) {
+    const uint32_t dirty = input.dirty;
+    if (!dirty) return;
+    input.dirty = 0;
+
+    for (InputCache* cache = caches; cache; cache = cache->next) {
+        if (cache->reads & dirty) {
+            cache->stale = true;
+        }
+    }
+}
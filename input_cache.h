@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include "types.h"
+
+/*
+    Cached frame encodings.
+
+    The parsers mark the INPUT_FIELD groups they change in SInput::dirty. A frame
+    builder declares the groups it reads with a global InputCache and re-encodes
+    its frame only when refresh() returns true. Otherwise the previous encoding is
+    sent again with just the alive counters and checksums patched.
+
+    Usage:
+        InputCache rpmCache(IN_RPM);
+
+        bool canSendRPM() {
+            static uint8_t data[8] = {...};
+            if (rpmCache.refresh()) {
+                // encode s_input.rpm into data
+            }
+            canSend(ID, data);
+        }
+*/
+
+class InputCache {
+public:
+    explicit InputCache(uint32_t reads);
+
+    // True on the first call and once after any of the read groups has changed
+    bool refresh() {
+        const bool result = stale;
+        stale = false;
+        return result;
+    }
+
+private:
+    friend void inputCacheUpdate(SInput& input);
+
+    const uint32_t reads;
+    bool stale;
+    InputCache* next;
+};
+
+// Hands the groups the parsers changed to every cache and clears them, called before the builders run
+void inputCacheUpdate(SInput& input);
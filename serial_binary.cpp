@@ -3,20 +3,25 @@
 #include "serial.h"
 #include "config.h"
 #include "pc_printf.h"
+#include "serial_binary.h"
+#include "fuel_calibration.h"
 
 extern SInput s_input;
 
-#define FRAME_LENGTH 35
-char rx_buf[FRAME_LENGTH];
+char rx_buf[SERIAL_FRAME_LENGTH];
 size_t rx_pos = 0;
 bool line_ready = false;
 
 void serialRead() {
     while (pc.available()) {
         char c = pc.read();
+#if defined(USE_FUEL_CALIBRATION)
+        if (rx_pos == 0 && c != 'S' && c != FUEL_CAL_FRAME_START) {
+#else
         if (rx_pos == 0 && c != 'S') {
+#endif
             // Waiting for the start character but received something else so ignore it
-        } else if (rx_pos == FRAME_LENGTH - 1) {
+        } else if (rx_pos == SERIAL_FRAME_LENGTH - 1) {
             rx_buf[rx_pos] = c;
             line_ready = true;
             rx_pos = 0;
@@ -45,13 +50,25 @@ void serialParse() {
     if (!line_ready) return;
     line_ready = false;
 
-    const uint8_t payloadLength = FRAME_LENGTH - 2;
-    const uint8_t* p = (const uint8_t*)rx_buf;
-
-    if (p[0] != 'S') {
-        serial_printf(pc, "[UART] Invalid frame marker\n");
+#if defined(USE_FUEL_CALIBRATION)
+    if (rx_buf[0] == FUEL_CAL_FRAME_START) {
+        if (serialChecksumValid((const uint8_t*)rx_buf)) {
+            fuelCalibrationCommand((const uint8_t*)&rx_buf[1]);
+        }
         return;
     }
+#endif
+
+    if (!serialParseFrame((const uint8_t*)rx_buf)) return;
+
+#ifdef LED_BUILTIN
+    digitalWrite(LED_BUILTIN, 1);
+#endif
+}
+
+// Additive checksum of everything between the start marker and the checksum itself
+bool serialChecksumValid(const uint8_t* p) {
+    const uint8_t payloadLength = SERIAL_FRAME_LENGTH - 2;
 
     uint8_t checksumReceived = p[payloadLength + 1];
     uint8_t checksumCalculated = 0;
@@ -62,141 +79,150 @@ void serialParse() {
 
     if (checksumCalculated != checksumReceived) {
         serial_printf(pc, "[UART] Checksum mismatch: received %02X, calculated %02X\n", checksumReceived, checksumCalculated);
-        return;
+        return false;
+    }
+
+    return true;
+}
+
+bool serialParseFrame(const uint8_t* p) {
+    if (p[0] != 'S') {
+        serial_printf(pc, "[UART] Invalid frame marker\n");
+        return false;
+    }
+
+    if (!serialChecksumValid(p)) {
+        return false;
     }
 
     int idx = 1; // skip 'S'
 
     // Timestamp
-    s_input.time_year   = p[idx++] + 2000;
-    s_input.time_month  = p[idx++];
-    s_input.time_day    = p[idx++];
-    s_input.time_hour   = p[idx++];
-    s_input.time_minute = p[idx++];
-    s_input.time_second = p[idx++];
+    s_input.set(s_input.time_year,   p[idx++] + 2000, IN_TIME);
+    s_input.set(s_input.time_month,  p[idx++], IN_TIME);
+    s_input.set(s_input.time_day,    p[idx++], IN_TIME);
+    s_input.set(s_input.time_hour,   p[idx++], IN_TIME);
+    s_input.set(s_input.time_minute, p[idx++], IN_TIME);
+    s_input.set(s_input.time_second, p[idx++], IN_TIME);
 
-    s_input.rpm         = parse_u16(&p[idx]); idx += 2;
-    s_input.speed       = parse_u16(&p[idx]); idx += 2;
+    s_input.set(s_input.rpm,         parse_u16(&p[idx]), IN_RPM); idx += 2;
+    s_input.set(s_input.speed,       parse_u16(&p[idx]), IN_SPEED); idx += 2;
 
     uint8_t gear        = p[idx++];
-    s_input.water_temp  = p[idx++];
-    s_input.oil_temp    = p[idx++];
-    s_input.fuel        = parse_u16(&p[idx]); idx += 2;
+    s_input.set(s_input.water_temp,  p[idx++], IN_TEMPS);
+    s_input.set(s_input.oil_temp,    p[idx++], IN_TEMPS);
+    s_input.set(s_input.fuel,        parse_u16(&p[idx]), IN_FUEL); idx += 2;
 
     uint32_t flags      = parse_u32(&p[idx]); idx += 4;
 
     // Parse flags using bitmasks
-    s_input.light_shift      = flags & (1UL << 0);
-    s_input.light_highbeam   = flags & (1UL << 1);
-    s_input.handbrake        = flags & (1UL << 2);
-    s_input.light_tc_active  = flags & (1UL << 4);
+    s_input.set(s_input.light_shift,      flags & (1UL << 0), IN_LIGHTS);
+    s_input.set(s_input.light_highbeam,   flags & (1UL << 1), IN_LIGHTS);
+    s_input.set(s_input.handbrake,        flags & (1UL << 2), IN_HANDBRAKE);
+    s_input.set(s_input.light_tc_active,  flags & (1UL << 4), IN_ASSISTS);
 
     bool left_signal  = flags & (1UL << 5);
     bool right_signal = flags & (1UL << 6);
 
     if (left_signal && right_signal)
-        s_input.indicator_state = I_HAZZARD;
+        s_input.set(s_input.indicator_state, I_HAZZARD, IN_INDICATOR);
     else if (left_signal)
-        s_input.indicator_state = I_LEFT;
+        s_input.set(s_input.indicator_state, I_LEFT, IN_INDICATOR);
     else if (right_signal)
-        s_input.indicator_state = I_RIGHT;
+        s_input.set(s_input.indicator_state, I_RIGHT, IN_INDICATOR);
     else
-        s_input.indicator_state = I_OFF;
-
-    s_input.oil_warn           = flags & (1UL << 8);
-    s_input.battery_warn       = flags & (1UL << 9);
-    s_input.abs_warn           = flags & (1UL << 10);
-    s_input.light_beacon       = flags & (1UL << 11);
-    s_input.light_lowbeam      = flags & (1UL << 12);
-    s_input.light_esc_active   = flags & (1UL << 13);
-    s_input.check_engine       = flags & (1UL << 14);
-    s_input.clutch_temp        = flags & (1UL << 15);
-    s_input.light_fog          = flags & (1UL << 16);
-    s_input.brake_temp         = flags & (1UL << 17);
-
-    s_input.tires.fl_deflated = flags & (1UL << 18);
-    s_input.tires.fr_deflated = flags & (1UL << 19);
-    s_input.tires.rl_deflated = flags & (1UL << 20);
-    s_input.tires.rr_deflated = flags & (1UL << 21);
-
-    bool all_deflated = s_input.tires.fl_deflated &&
-                        s_input.tires.fr_deflated &&
-                        s_input.tires.rl_deflated &&
-                        s_input.tires.rr_deflated;
-
-    s_input.tires.all_deflated = all_deflated;
-    if (all_deflated) {
-        s_input.tires.fl_deflated = false;
-        s_input.tires.fr_deflated = false;
-        s_input.tires.rl_deflated = false;
-        s_input.tires.rr_deflated = false;
-    }
-
-    s_input.radiator_warn      = flags & (1UL << 22);
-    s_input.engine_temp_yellow = flags & (1UL << 23);
-    s_input.engine_temp_red    = flags & (1UL << 24);
-
-    s_input.doors.fl_open = flags & (1UL << 25);
-    s_input.doors.fr_open = flags & (1UL << 26);
-    s_input.doors.rl_open = flags & (1UL << 27);
-    s_input.doors.rr_open = flags & (1UL << 28);
-    s_input.doors.tailgate_open = flags & (1UL << 29);
-
-    s_input.light_tc_disabled  = flags & (1UL << 30);
-    s_input.light_esc_disabled = flags & (1UL << 31);
+        s_input.set(s_input.indicator_state, I_OFF, IN_INDICATOR);
+
+    s_input.set(s_input.oil_warn,           flags & (1UL << 8), IN_WARNINGS);
+    s_input.set(s_input.battery_warn,       flags & (1UL << 9), IN_WARNINGS);
+    s_input.set(s_input.abs_warn,           flags & (1UL << 10), IN_WARNINGS);
+    s_input.set(s_input.light_beacon,       flags & (1UL << 11), IN_LIGHTS);
+    s_input.set(s_input.light_lowbeam,      flags & (1UL << 12), IN_LIGHTS);
+    s_input.set(s_input.light_esc_active,   flags & (1UL << 13), IN_ASSISTS);
+    s_input.set(s_input.check_engine,       flags & (1UL << 14), IN_WARNINGS);
+    s_input.set(s_input.clutch_temp,        flags & (1UL << 15), IN_WARNINGS);
+    s_input.set(s_input.light_fog,          flags & (1UL << 16), IN_LIGHTS);
+    s_input.set(s_input.brake_temp,         flags & (1UL << 17), IN_WARNINGS);
+
+    bool fl_deflated = flags & (1UL << 18);
+    bool fr_deflated = flags & (1UL << 19);
+    bool rl_deflated = flags & (1UL << 20);
+    bool rr_deflated = flags & (1UL << 21);
+
+    // All four are shown with their own symbol instead, decide before storing so
+    // the individual ones are not flagged as changed in between
+    bool all_deflated = fl_deflated && fr_deflated && rl_deflated && rr_deflated;
+
+    s_input.set(s_input.tires.all_deflated, all_deflated, IN_TIRES);
+    s_input.set(s_input.tires.fl_deflated, fl_deflated && !all_deflated, IN_TIRES);
+    s_input.set(s_input.tires.fr_deflated, fr_deflated && !all_deflated, IN_TIRES);
+    s_input.set(s_input.tires.rl_deflated, rl_deflated && !all_deflated, IN_TIRES);
+    s_input.set(s_input.tires.rr_deflated, rr_deflated && !all_deflated, IN_TIRES);
+
+    s_input.set(s_input.radiator_warn,      flags & (1UL << 22), IN_WARNINGS);
+    s_input.set(s_input.engine_temp_yellow, flags & (1UL << 23), IN_WARNINGS);
+    s_input.set(s_input.engine_temp_red,    flags & (1UL << 24), IN_WARNINGS);
+
+    s_input.set(s_input.doors.fl_open, flags & (1UL << 25), IN_DOORS);
+    s_input.set(s_input.doors.fr_open, flags & (1UL << 26), IN_DOORS);
+    s_input.set(s_input.doors.rl_open, flags & (1UL << 27), IN_DOORS);
+    s_input.set(s_input.doors.rr_open, flags & (1UL << 28), IN_DOORS);
+    s_input.set(s_input.doors.tailgate_open, flags & (1UL << 29), IN_DOORS);
+
+    s_input.set(s_input.light_tc_disabled,  flags & (1UL << 30), IN_ASSISTS);
+    s_input.set(s_input.light_esc_disabled, flags & (1UL << 31), IN_ASSISTS);
 
     uint8_t flagsExt = p[idx++];
-    s_input.yellow_triangle  = flagsExt & (1UL << 0);
-    s_input.red_triangle     = flagsExt & (1UL << 1);
-    s_input.gear_issue       = flagsExt & (1UL << 2);
-    s_input.exclamation_mark = flagsExt & (1UL << 3);
-    s_input.adblue_low       = flagsExt & (1UL << 4);
-    s_input.checkered_flag   = flagsExt & (1UL << 5);
-    s_input.limit_yellow     = flagsExt & (1UL << 6);
-    s_input.limit_red        = flagsExt & (1UL << 7);
-
-    s_input.fuel_injection   = parse_u16(&p[idx]); idx += 2;
-    s_input.custom_light     = parse_u16(&p[idx]); idx += 2;
-    s_input.custom_light_on  = p[idx++] != 0;
+    s_input.set(s_input.yellow_triangle,  flagsExt & (1UL << 0), IN_WARNINGS);
+    s_input.set(s_input.red_triangle,     flagsExt & (1UL << 1), IN_WARNINGS);
+    s_input.set(s_input.gear_issue,       flagsExt & (1UL << 2), IN_WARNINGS);
+    s_input.set(s_input.exclamation_mark, flagsExt & (1UL << 3), IN_WARNINGS);
+    s_input.set(s_input.adblue_low,       flagsExt & (1UL << 4), IN_WARNINGS);
+    s_input.set(s_input.checkered_flag,   flagsExt & (1UL << 5), IN_WARNINGS);
+    s_input.set(s_input.limit_yellow,     flagsExt & (1UL << 6), IN_WARNINGS);
+    s_input.set(s_input.limit_red,        flagsExt & (1UL << 7), IN_WARNINGS);
+
+    s_input.set(s_input.fuel_injection,   parse_u16(&p[idx]), IN_FUEL_INJECTION); idx += 2;
+    uint16_t customLight     = parse_u16(&p[idx]); idx += 2;
+    uint8_t customLightOp    = p[idx++];
+    s_input.customLight(customLight, customLightOp);  // Frames repeat, so no error when the set is full
     uint8_t gearMode         = p[idx++];
-    s_input.cruise.speed     = parse_u16(&p[idx]); idx += 2;
+    s_input.set(s_input.cruise.speed,     parse_u16(&p[idx]), IN_CRUISE); idx += 2;
 
     uint8_t cruiseMode       = p[idx++];
-    s_input.cruise.enabled   = cruiseMode & 0x01;
-    s_input.cruise.acc.yellow_car_static = (cruiseMode & 0x02) != 0;
-    s_input.cruise.acc.red_car_blinking = (cruiseMode & 0x04) != 0;
+    s_input.set(s_input.cruise.enabled,   cruiseMode & 0x01, IN_CRUISE);
+    s_input.set(s_input.cruise.acc.yellow_car_static, (cruiseMode & 0x02) != 0, IN_CRUISE);
+    s_input.set(s_input.cruise.acc.red_car_blinking, (cruiseMode & 0x04) != 0, IN_CRUISE);
     uint8_t distanceCode = (cruiseMode >> 3) & 0x07;
-    s_input.cruise.acc.distance = (distanceCode >= 1 && distanceCode <= 4) ? distanceCode : 0;
+    s_input.set(s_input.cruise.acc.distance, (distanceCode >= 1 && distanceCode <= 4) ? distanceCode : 0, IN_CRUISE);
 
-    s_input.ignition         = (IGNITION_STATE)p[idx++];
-    s_input.engine_running   = p[idx++] != 0;
+    s_input.set(s_input.ignition,         (IGNITION_STATE)p[idx++], IN_IGNITION);
+    s_input.set(s_input.engine_running,   p[idx++] != 0, IN_IGNITION);
 
-    s_input.ambient_temp = parse_u16(&p[idx]); idx += 2;
+    s_input.set(s_input.ambient_temp, parse_u16(&p[idx]), IN_AMBIENT); idx += 2;
 
     // Gear logic
     if (gearMode == 'P') {
-        s_input.explicitGear = NONE;
-        s_input.currentGear = PARK;
-        s_input.mode = NORMAL;
+        s_input.set(s_input.explicitGear, NONE, IN_GEAR);
+        s_input.set(s_input.currentGear, PARK, IN_GEAR);
+        s_input.set(s_input.mode, NORMAL, IN_GEAR);
     } else if (gear == NEUTRAL) {
-        s_input.explicitGear = NONE;
-        s_input.currentGear = NEUTRAL;
-        s_input.mode = NORMAL;
+        s_input.set(s_input.explicitGear, NONE, IN_GEAR);
+        s_input.set(s_input.currentGear, NEUTRAL, IN_GEAR);
+        s_input.set(s_input.mode, NORMAL, IN_GEAR);
     } else if (gear == REVERSE) {
-        s_input.explicitGear = NONE;
-        s_input.currentGear = REVERSE;
-        s_input.mode = NORMAL;
+        s_input.set(s_input.explicitGear, NONE, IN_GEAR);
+        s_input.set(s_input.currentGear, REVERSE, IN_GEAR);
+        s_input.set(s_input.mode, NORMAL, IN_GEAR);
     } else if (gearMode == 'A') {
-        s_input.explicitGear = NONE;
-        s_input.currentGear = DRIVE;
-        s_input.mode = NORMAL;
+        s_input.set(s_input.explicitGear, NONE, IN_GEAR);
+        s_input.set(s_input.currentGear, DRIVE, IN_GEAR);
+        s_input.set(s_input.mode, NORMAL, IN_GEAR);
     } else {
-        s_input.explicitGear = (GEAR_MANUAL)(min(gear - 1, NUMBER_OF_GEARS));
-        s_input.currentGear = DRIVE;
-        s_input.mode = (gearMode == 'S') ? SPORT : NORMAL;
+        s_input.set(s_input.explicitGear, (GEAR_MANUAL)(min(gear - 1, NUMBER_OF_GEARS)), IN_GEAR);
+        s_input.set(s_input.currentGear, DRIVE, IN_GEAR);
+        s_input.set(s_input.mode, (gearMode == 'S') ? SPORT : NORMAL, IN_GEAR);
     }
 
-#ifdef LED_BUILTIN
-    digitalWrite(LED_BUILTIN, 1);
-#endif
+    return true;
 }
@@ -1,4 +1,15 @@
 #pragma once
 
+#include <stdint.h>
+
+// 'S' frame including the start marker and checksum, see README
+#define SERIAL_FRAME_LENGTH 35
+
 void serialRead();
-void serialParse();
\ No newline at end of file
+void serialParse();
+
+// Checksum of a complete 'S' or 'C' frame
+bool serialChecksumValid(const uint8_t* frame);
+
+// Validates and applies a complete 'S' frame
+bool serialParseFrame(const uint8_t* frame);
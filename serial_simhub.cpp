@@ -1,4 +1,6 @@
 #include <Arduino.h>
+#include "serial_simhub.h"
+#include "config.h"
 
 #define VERSION 'j'
 #define DEVICE_NAME "E90 Cluster (veikkos)"
@@ -41,19 +43,24 @@ SHCustomProtocol shCustomProtocol;
 char loop_opt;
 unsigned long lastSerialActivity = 0;
 
+SimHubBackgroundTask backgroundTask = 0;
+
 void simHubIdle(bool critical) {
     shCustomProtocol.idle();
+    if (backgroundTask != 0) backgroundTask();
 }
 
-void simHubSetup()
+void simHubSetup(SimHubBackgroundTask task)
 {
-	FlowSerialBegin(19200);
+	backgroundTask = task;
+	FlowSerialBegin(SIMHUB_SERIAL_BAUD);
 
 	shCustomProtocol.setup();
 	arqserial.setIdleFunction(simHubIdle);
 }
 
 void simHubSerialRead() {
+	SimHubBaudService();
 	shCustomProtocol.loop();
 
 	// Wait for data
@@ -102,5 +109,7 @@ void simHubSerialRead() {
 
 	if (millis() - lastSerialActivity > 5000) {
 		Command_Shutdown();
+		// Host reconnects at the base rate
+		SimHubBaudReset();
 	}
 }
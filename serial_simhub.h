@@ -1,5 +1,8 @@
 #pragma once
 
-void simHubSetup();
+// Called whenever the SimHub link waits for more data
+typedef void (*SimHubBackgroundTask)();
+
+void simHubSetup(SimHubBackgroundTask task);
 void simHubSerialRead();
-void simHubSerialParse();
+void simHubSerialParse();
\ No newline at end of file
@@ -0,0 +1,119 @@
+// Compact custom protocol for SimHub, use as a JavaScript formula instead of custom_protocol.txt.
+// Sends the same fields as the binary 'S' frame (see README) as fixed width base 64 digits,
+// ('0' + 0-63, most significant first) after a '#' marker, 42 bytes per update in total.
+// Properties a game does not provide read as off. The lights, doors and cruise control
+// properties below are from Euro Truck Simulator 2 / American Truck Simulator, adjust for other games.
+
+function p(name) {
+    var v = $prop(name);
+    return v === null || v === undefined ? 0 : v;
+}
+
+function on(name) {
+    return p(name) ? 1 : 0;
+}
+
+function digits(value, count) {
+    var s = '';
+    value = Math.max(0, Math.round(value));
+    for (var i = count - 1; i >= 0; i--) {
+        s += String.fromCharCode(48 + Math.floor(value / Math.pow(64, i)) % 64);
+    }
+    return s;
+}
+
+// Bitfields are built with arithmetic as JavaScript bit operators are signed 32-bit
+function bits(list) {
+    var value = 0;
+    for (var i = 0; i < list.length; i++) {
+        if (list[i][1]) value += Math.pow(2, list[i][0]);
+    }
+    return value;
+}
+
+var raw = 'DataCorePlugin.GameRawData.TruckValues.CurrentValues.';
+var data = 'DataCorePlugin.GameData.NewData.';
+
+// Tire pressure below this is shown as deflated, the unit depends on the game
+var LOW_TYRE_PRESSURE = 10;
+function tyreLow(tyre) {
+    var pressure = $prop(data + 'TyrePressure' + tyre);
+    return pressure !== null && pressure !== undefined && pressure < LOW_TYRE_PRESSURE ? 1 : 0;
+}
+
+var rpm = p(data + 'Rpms');
+var ignition = on(data + 'EngineIgnitionOn') ? 2 : 0;
+var engineRunning = rpm > 100 ? 1 : 0;
+
+// 0 = R, 1 = N, 2+ = forward gears
+var gearText = String(p(data + 'Gear') || 'N');
+var gear = 1;
+var gearMode = 'M';
+if (gearText === 'R') {
+    gear = 0;
+} else if (gearText === 'P') {
+    gearMode = 'P';
+} else if (gearText !== 'N') {
+    gear = parseInt(gearText, 10) + 1 || 1;
+}
+
+var lowBeam = $prop(raw + 'LightsValues.BeamLow');
+
+var showlights = bits([
+    [1, on(raw + 'LightsValues.BeamHigh')],
+    [2, on(data + 'Handbrake')],
+    [4, on(data + 'TCActive')],
+    [5, on(data + 'TurnIndicatorLeft')],
+    [6, on(data + 'TurnIndicatorRight')],
+    [10, on(data + 'ABSActive')],
+    [11, on(raw + 'LightsValues.Beacon')],
+    [12, lowBeam === null || lowBeam === undefined ? ignition : lowBeam],
+    [16, on(raw + 'LightsValues.AuxFront')],
+    [18, tyreLow('FrontLeft')],
+    [19, tyreLow('FrontRight')],
+    [20, tyreLow('RearLeft')],
+    [21, tyreLow('RearRight')],
+    [25, on(data + 'DoorOpenFrontLeft')],
+    [26, on(data + 'DoorOpenFrontRight')],
+    [27, on(data + 'DoorOpenRearLeft')],
+    [28, on(data + 'DoorOpenRearRight')],
+    [29, on(data + 'TailgateOpen')]
+]);
+
+var showlightsExt = 0;
+
+var cruiseOn = on(raw + 'DashboardValues.CruiseControl');
+var cruiseSpeed = cruiseOn ? p(raw + 'DashboardValues.CruiseControlSpeed.Kph') : 0;
+
+var now = new Date();
+var ambient = Math.round(p(data + 'AirTemperature') * 10);
+
+var body =
+    digits(now.getFullYear() - 2000, 1) +
+    digits(now.getMonth() + 1, 1) +
+    digits(now.getDate(), 1) +
+    digits(now.getHours(), 1) +
+    digits(now.getMinutes(), 1) +
+    digits(now.getSeconds(), 1) +
+    digits(rpm, 3) +
+    digits(p(data + 'SpeedKmh') * 10, 3) +
+    digits(gear, 1) +
+    digits(p(data + 'WaterTemperature'), 2) +
+    digits(p(data + 'OilTemperature'), 2) +
+    digits(p(data + 'FuelPercent') * 10, 2) +
+    digits(showlights, 6) +
+    digits(showlightsExt, 2) +
+    digits(p('DataCorePlugin.GameData.InstantConsumption_L100KM') * p(data + 'SpeedKmh') * 5 / 18, 3) +
+    gearMode +
+    digits(cruiseSpeed, 2) +
+    digits(cruiseOn, 1) +
+    digits(ignition, 1) +
+    digits(engineRunning, 1) +
+    digits(ambient < 0 ? ambient + 65536 : ambient, 3);
+
+var sum = 0;
+for (var i = 0; i < body.length; i++) {
+    sum += body.charCodeAt(i) - 48;
+}
+
+return '#' + body + digits(sum % 64, 1) + '\n';
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    Lock-free single-producer/single-consumer ring buffer.
+
+    Exactly one context may push (e.g. an ISR or the main loop) and exactly one
+    may pop, so no critical sections are needed and interrupts are never masked.
+    The head index is only written by the producer and the tail index only by the
+    consumer. Both run freely and are masked on access, which lets every slot be
+    used and keeps size() a single subtraction.
+
+    Capacity must be a power of two. On AVR the indices are one byte wide as that
+    is the only size the CPU reads and writes atomically, which limits the
+    capacity to 128 there.
+*/
+
+#if defined(__AVR__)
+    // Single core and in-order so stopping the compiler from reordering is enough
+    #define SPSC_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+    // Full hardware barrier, needed e.g. between the two ESP32 cores
+    #define SPSC_BARRIER() __sync_synchronize()
+#endif
+
+template <bool Small> struct SpscIndex { typedef uint16_t type; };
+template <> struct SpscIndex<true> { typedef uint8_t type; };
+
+template <typename T, size_t Capacity>
+class SpscRing {
+public:
+    typedef typename SpscIndex<(Capacity <= 128)>::type index_t;
+
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    static_assert(Capacity <= 32768, "Capacity must fit a 16-bit free-running index");
+#if defined(__AVR__)
+    static_assert(Capacity <= 128, "AVR can only access one byte indices atomically");
+#endif
+
+    SpscRing() : head(0), tail(0) {}
+
+    // Producer side
+
+    bool push(const T& element) {
+        const index_t h = head;
+        if ((index_t)(h - tail) == Capacity) return false;
+        buffer[h & MASK] = element;
+        SPSC_BARRIER();  // Publish the slot before the index
+        head = h + 1;
+        return true;
+    }
+
+    // Pushes up to count elements and returns how many fit
+    size_t push(const T* elements, size_t count) {
+        const index_t h = head;
+        const size_t space = Capacity - (index_t)(h - tail);
+        if (count > space) count = space;
+
+        const size_t start = h & MASK;
+        const size_t first = count < Capacity - start ? count : Capacity - start;
+        copy(&buffer[start], elements, first);
+        copy(&buffer[0], elements + first, count - first);
+
+        SPSC_BARRIER();
+        head = h + count;
+        return count;
+    }
+
+    // Consumer side
+
+    bool pop(T& element) {
+        const index_t t = tail;
+        if (head == t) return false;
+        SPSC_BARRIER();  // Do not read the slot before seeing the index
+        element = buffer[t & MASK];
+        SPSC_BARRIER();  // Finish reading before handing the slot back
+        tail = t + 1;
+        return true;
+    }
+
+    // Pops up to count elements and returns how many were available
+    size_t pop(T* elements, size_t count) {
+        const index_t t = tail;
+        const size_t available = (index_t)(head - t);
+        if (count > available) count = available;
+        SPSC_BARRIER();
+
+        const size_t start = t & MASK;
+        const size_t first = count < Capacity - start ? count : Capacity - start;
+        copy(elements, &buffer[start], first);
+        copy(elements + first, &buffer[0], count - first);
+
+        SPSC_BARRIER();
+        tail = t + count;
+        return count;
+    }
+
+    bool peek(T& element) const {
+        const index_t t = tail;
+        if (head == t) return false;
+        SPSC_BARRIER();
+        element = buffer[t & MASK];
+        return true;
+    }
+
+    // Drops everything currently queued, consumer side only
+    void clear() { tail = head; }
+
+    // Only when the producer and the consumer are the same context
+    bool contains(const T& element) const {
+        for (index_t i = tail; i != head; ++i) {
+            if (buffer[i & MASK] == element) return true;
+        }
+        return false;
+    }
+
+    // Either side
+
+    size_t size() const { return (index_t)(head - tail); }
+    bool isEmpty() const { return head == tail; }
+    bool isFull() const { return size() == Capacity; }
+    static size_t capacity() { return Capacity; }
+
+private:
+    static const index_t MASK = Capacity - 1;
+
+    static void copy(T* dst, const T* src, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            dst[i] = src[i];
+        }
+    }
+
+    T buffer[Capacity];
+    volatile index_t head;
+    volatile index_t tail;
+};
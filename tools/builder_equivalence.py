@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""
+Checks that two revisions of the sketch send the same CAN frames.
+
+Builds the sketch of each revision on the host with g++, with the Arduino
+core and the CAN adapter replaced by tools/host/. Both run against the same
+simulated clock and the same random stream of binary protocol frames from
+the PC, and every frame they send is compared: ID, data and the millisecond
+it was sent at. Use it for refactors of the frame builders that must not
+change what the cluster sees, e.g. moving a builder to CanSignal layouts.
+
+OLD and NEW are git revisions, NEW defaults to the working tree. -D builds
+both with a config.h option, only options that need no extra hardware
+library can be used, e.g. -D USE_NEEDLE_LEAD.
+
+Exit code is 1 if the frames differ or a build fails.
+
+Usage:
+    python3 tools/builder_equivalence.py OLD [NEW] [--seconds 600] [--seed 1]
+        [-D USE_NEEDLE_LEAD ...]
+"""
+
+import argparse
+import glob
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.abspath(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+HOST = os.path.join(ROOT, 'tools', 'host')
+
+
+def checkout(rev, directory):
+    """Sketch sources of a revision, None for the working tree"""
+    if rev is None:
+        return ROOT
+    archive = subprocess.run(['git', '-C', ROOT, 'archive', rev], stdout=subprocess.PIPE, check=True).stdout
+    subprocess.run(['tar', '-x', '-C', directory], input=archive, check=True)
+    return directory
+
+
+def build(src, out, defines):
+    """Host binary of the sketch in src with the harness, None if the build failed"""
+    # The sketch is C++, the adapters talk to hardware and are replaced by the harness
+    sources = [os.path.join(src, 'e90-can-cluster.ino')]
+    sources += [f for f in sorted(glob.glob(os.path.join(src, '*.cpp')))
+                if not os.path.basename(f).startswith('can_adapter_')]
+    objects = []
+    for source in sources + [os.path.join(HOST, 'harness.cpp')]:
+        obj = os.path.join(out, os.path.basename(source) + '.o')
+        cmd = ['g++', '-std=gnu++11', '-O1', '-w', '-I', HOST, '-I', src]
+        cmd += ['-D' + d for d in defines]
+        cmd += ['-x', 'c++', '-c', source, '-o', obj]
+        result = subprocess.run(cmd, stderr=subprocess.PIPE, universal_newlines=True)
+        if result.returncode:
+            sys.stderr.write(result.stderr)
+            return None
+        objects.append(obj)
+    binary = os.path.join(out, 'sketch')
+    result = subprocess.run(['g++', '-o', binary] + objects, stderr=subprocess.PIPE, universal_newlines=True)
+    if result.returncode:
+        sys.stderr.write(result.stderr)
+        return None
+    return binary
+
+
+def run(binary, seed, seconds):
+    output = subprocess.run([binary, str(seed), str(seconds)], stdout=subprocess.PIPE,
+                            universal_newlines=True, check=True).stdout
+    return output.splitlines()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare the CAN frames sent by two revisions of the sketch')
+    parser.add_argument('old', help='Git revision')
+    parser.add_argument('new', nargs='?', help='Git revision, the working tree if not given')
+    parser.add_argument('--seconds', type=int, default=600, help='Simulated run time')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('-D', '--define', action='append', default=[], metavar='NAME[=VALUE]',
+                        help='Build both with this config.h option, can be repeated')
+    args = parser.parse_args()
+
+    work = tempfile.mkdtemp(prefix='builder_equivalence_')
+    try:
+        frames = []
+        for name, rev in (('old', args.old), ('new', args.new)):
+            directory = os.path.join(work, name)
+            os.makedirs(os.path.join(directory, 'build'))
+            binary = build(checkout(rev, directory), os.path.join(directory, 'build'), args.define)
+            if binary is None:
+                print('Build of %s failed' % (rev or 'the working tree'))
+                return 1
+            frames.append(run(binary, args.seed, args.seconds))
+    finally:
+        shutil.rmtree(work)
+
+    old, new = frames
+    differing = [(a, b) for a, b in zip(old, new) if a != b]
+    print('%d s simulated, %d frames old, %d frames new' % (args.seconds, len(old), len(new)))
+    if differing or len(old) != len(new):
+        print('%d frames differ, first:' % (len(differing) + abs(len(old) - len(new))))
+        first = next(((a, b) for a, b in zip(old, new) if a != b), None)
+        if first is None:
+            first = (old[len(new)] if len(old) > len(new) else '(none)',
+                     new[len(old)] if len(new) > len(old) else '(none)')
+        print('  old: %s\n  new: %s' % first)
+        return 1
+
+    print('Identical')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
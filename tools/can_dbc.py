@@ -0,0 +1,301 @@
+#!/usr/bin/env python3
+"""
+DBC export and import for the CAN messages of the sketch.
+
+export: reads e90-can-cluster.ino and writes a DBC describing every frame the
+firmware sends (functions with `const uint32_t ID = ...`) and every frame it
+reads (handler_table). Signals come from the CanSignal, CanCounter and
+CanXorChecksum typedefs in each function, see can_signal.h. A trailing comment
+that starts with a unit, optionally scaled (`// 0.1 km/h, ...`), sets the DBC
+unit and factor; the rest of the comment becomes the signal comment. Cycle
+times are taken from the scheduler groups like tools/can_schedule.py does,
+with the same config.h options.
+
+import: reads a DBC and prints the signal typedefs for each message in the
+form the frame builders use, ready to paste into a builder or handler.
+
+Usage:
+    python3 tools/can_dbc.py export [--ino e90-can-cluster.ino] [-o e90.dbc] [-D USE_SPEED_HIGH_RATE ...]
+    python3 tools/can_dbc.py import e90.dbc [--id 0x1A0 ...]
+"""
+
+import argparse
+import os
+import re
+import sys
+from fractions import Fraction
+
+from can_schedule import ERROR_LIGHT_ID, TICK_MS, block_at, parse_groups, parse_messages, read_sketch, strip_comments
+
+TX_NODE = 'Emulator'
+RX_NODE = 'Cluster'
+DBC_ENCODING = 'cp1252'  # What most DBC tools expect, covers ° and ²
+
+UNITS = ['km/h', 'mph', 'rpm', '°C', 'm/s²', 'deg/s', 'km', 'l', '%', 'ms', 's']
+UNIT_RE = re.compile(r'^(?:(\d+(?:\.\d+)?)\s+)?(' + '|'.join(re.escape(u) for u in UNITS) + r')$')
+
+TYPEDEF_RE = re.compile(r'typedef\s+(CanSignal|CanCounter|CanXorChecksum)\s*<([^>]*)>\s*(\w+)\s*;'
+                        r'[ \t]*(?://[ \t]*([^\n]*))?')
+FUNCTION_RE = re.compile(r'^(?:bool|void)\s+(\w+)\s*\([^)]*\)\s*\{', re.M)
+
+
+class Signal:
+    def __init__(self, name, start, length, factor=Fraction(1), offset=Fraction(0), unit='', comment='',
+                 kind='signal', signed=False):
+        self.name = name
+        self.start = start
+        self.length = length
+        self.factor = factor
+        self.offset = offset
+        self.unit = unit
+        self.comment = comment
+        self.kind = kind
+        self.signed = signed
+
+
+class Message:
+    def __init__(self, can_id, name, dlc, sender, source=''):
+        self.can_id = can_id
+        self.name = name
+        self.dlc = dlc
+        self.sender = sender
+        self.source = source
+        self.cycle_ms = 0
+        self.signals = []
+
+
+def number(value):
+    value = float(value)
+    return str(int(value)) if value == int(value) else '%.10g' % value
+
+
+def parse_signal(kind, args, name, comment):
+    args = [int(a.strip(), 0) for a in args.split(',')]
+    comment = (comment or '').strip()
+
+    if kind == 'CanXorChecksum':
+        return Signal(name, args[0] * 8, 8, comment='XOR of bytes 0-%d' % (args[0] - 1), kind='checksum')
+
+    if kind == 'CanCounter':
+        text = 'Alive counter' if len(args) < 3 else 'Alive counter modulo %d' % args[2]
+        return Signal(name, args[0], args[1], comment=text + (', ' + comment if comment else ''), kind='counter')
+
+    start, length = args[0], args[1]
+    factor = Fraction(args[2] if len(args) > 2 else 1, args[3] if len(args) > 3 else 1)
+    offset = Fraction(args[4] if len(args) > 4 else 0)
+    unit = ''
+
+    first, _, rest = comment.partition(',')
+    unit_match = UNIT_RE.match(first.strip())
+    if unit_match:
+        scale = Fraction(unit_match.group(1) or '1')
+        factor *= scale
+        offset *= scale
+        unit = unit_match.group(2)
+        comment = rest.strip()
+
+    return Signal(name, start, length, factor, offset, unit, comment)
+
+
+def parse_sketch(raw, compiled=None, defines=None):
+    """Messages sent and received by the sketch, sorted by ID. Cycle times come from compiled, the
+    sketch as preprocessed with the config, all messages from raw."""
+    src = strip_comments(raw)
+    messages = {}
+    seen = set()
+
+    rx_ids = {handler: int(can_id, 16) for can_id, handler in
+              re.findall(r'\{\s*(0x[0-9A-Fa-f]+)\s*,\s*(\w+)\s*\}', src)}
+    queued = parse_messages(src)
+
+    for m in FUNCTION_RE.finditer(raw):
+        name = m.group(1)
+        if name in seen:
+            continue  # Alternatives under #else, the first one is the default
+        seen.add(name)
+        body = block_at(raw, m.start())
+        id_match = re.search(r'const\s+uint32_t\s+ID\s*=\s*(0x[0-9A-Fa-f]+)', body)
+
+        if id_match:
+            can_id = int(id_match.group(1), 16)
+            dlc = queued[name][1] if name in queued else 8
+            label = re.sub(r'^can(Send)?', '', name)
+            message = Message(can_id, label, dlc, TX_NODE, name)
+        elif name in rx_ids:
+            message = Message(rx_ids[name], '%s_%03X' % (RX_NODE, rx_ids[name]), 8, RX_NODE, name)
+        else:
+            continue
+
+        for kind, args, signal, comment in TYPEDEF_RE.findall(body):
+            message.signals.append(parse_signal(kind, args, signal, comment))
+        messages[message.can_id] = message
+
+    # Fastest period each ID is queued at, the check-control symbols are event driven
+    for period, _, tasks in parse_groups(strip_comments(compiled or raw), defines):
+        for task in tasks:
+            message = messages.get(queued[task][0]) if task in queued else None
+            if message and message.can_id != ERROR_LIGHT_ID:
+                ms = period * TICK_MS
+                message.cycle_ms = min(message.cycle_ms or ms, ms)
+
+    return [messages[can_id] for can_id in sorted(messages)]
+
+
+def write_dbc(messages, out):
+    out.write('VERSION ""\n\n\n')
+    out.write('NS_ :\n\tCM_\n\tBA_DEF_\n\tBA_\n\tBA_DEF_DEF_\n\n')
+    out.write('BS_:\n\n')
+    out.write('BU_: %s %s\n\n' % (TX_NODE, RX_NODE))
+
+    for message in messages:
+        receiver = RX_NODE if message.sender == TX_NODE else TX_NODE
+        out.write('\nBO_ %d %s: %d %s\n' % (message.can_id, message.name, message.dlc, message.sender))
+        for s in message.signals:
+            raw_max = (1 << s.length) - 1
+            low, high = sorted([s.offset, raw_max * s.factor + s.offset])
+            out.write(' SG_ %s : %d|%d@1%s (%s,%s) [%s|%s] "%s" %s\n'
+                      % (s.name, s.start, s.length, '-' if s.signed else '+', number(s.factor), number(s.offset),
+                         number(low), number(high), s.unit, receiver))
+
+    out.write('\n')
+    for message in messages:
+        out.write('CM_ BO_ %d "%s";\n' % (message.can_id, message.source))
+        for s in message.signals:
+            if s.comment:
+                out.write('CM_ SG_ %d %s "%s";\n' % (message.can_id, s.name, s.comment.replace('"', "'")))
+
+    out.write('BA_DEF_ BO_ "GenMsgCycleTime" INT 0 65535;\n')
+    out.write('BA_DEF_DEF_ "GenMsgCycleTime" 0;\n')
+    for message in messages:
+        if message.cycle_ms:
+            out.write('BA_ "GenMsgCycleTime" BO_ %d %d;\n' % (message.can_id, message.cycle_ms))
+
+
+def read_dbc(text):
+    messages = {}
+    current = None
+
+    for line in text.splitlines():
+        bo = re.match(r'^BO_\s+(\d+)\s+(\w+)\s*:\s*(\d+)\s+(\w+)', line)
+        if bo:
+            can_id = int(bo.group(1)) & 0x1FFFFFFF
+            current = Message(can_id, bo.group(2), int(bo.group(3)), bo.group(4))
+            messages[can_id] = current
+            continue
+
+        sg = re.match(r'^\s+SG_\s+(\w+)\s*(\S*)\s*:\s*(\d+)\|(\d+)@([01])([+-])\s*\(([^,]+),([^)]+)\)'
+                      r'\s*\[[^\]]*\]\s*"([^"]*)"', line)
+        if sg and current:
+            signal = Signal(sg.group(1), int(sg.group(3)), int(sg.group(4)),
+                            Fraction(sg.group(7).strip()), Fraction(sg.group(8).strip()), sg.group(9),
+                            signed=sg.group(6) == '-')
+            signal.motorola = sg.group(5) == '0'
+            signal.multiplexed = bool(sg.group(2))
+            current.signals.append(signal)
+            continue
+
+    for can_id, name, comment in re.findall(r'CM_\s+SG_\s+(\d+)\s+(\w+)\s+"([^"]*)"\s*;', text):
+        message = messages.get(int(can_id) & 0x1FFFFFFF)
+        for s in message.signals if message else []:
+            if s.name == name:
+                s.comment = comment
+
+    for can_id, ms in re.findall(r'BA_\s+"GenMsgCycleTime"\s+BO_\s+(\d+)\s+(\d+)\s*;', text):
+        message = messages.get(int(can_id) & 0x1FFFFFFF)
+        if message:
+            message.cycle_ms = int(ms)
+
+    return [messages[can_id] for can_id in sorted(messages)]
+
+
+def typedef_for(s):
+    """Typedef line for a DBC signal, or a comment saying why there is none"""
+    if getattr(s, 'motorola', False):
+        return '// %s is big endian (Motorola), CanSignal only supports Intel byte order' % s.name
+    if getattr(s, 'multiplexed', False):
+        return '// %s is multiplexed, not supported' % s.name
+
+    text = (s.name + ' ' + s.comment).lower()
+    if 'checksum' in text or 'crc' in text:
+        if 'xor' in text and s.length == 8 and s.start % 8 == 0:
+            return 'typedef CanXorChecksum<%d> %s;' % (s.start // 8, s.name)
+        return '// %s is a checksum of an unknown kind' % s.name
+    if 'counter' in text or s.name.lower() == 'alive':
+        modulo = re.search(r'modulo\s+(\d+)', text)
+        args = (s.start, s.length) + ((int(modulo.group(1)),) if modulo else ())
+        return 'typedef CanCounter<%s> %s;' % (', '.join(str(a) for a in args), s.name)
+
+    factor = s.factor.limit_denominator(1000000)
+    notes = [s.unit] if s.unit else []
+    if s.offset.denominator != 1:
+        notes.append('offset %s rounded' % number(s.offset))
+    if s.signed:
+        notes.append('signed, decode as two\'s complement')
+    if s.comment:
+        notes.append(s.comment)
+
+    args = [s.start, s.length]
+    if factor != 1 or s.offset:
+        args += [factor.numerator, factor.denominator]
+    if s.offset:
+        args.append(int(round(s.offset)))
+
+    line = 'typedef CanSignal<%s> %s;' % (', '.join(str(a) for a in args), s.name)
+    return line + ('  // ' + ', '.join(notes) if notes else '')
+
+
+def write_typedefs(messages, out):
+    for message in messages:
+        period = ', every %d ms' % message.cycle_ms if message.cycle_ms else ''
+        out.write('// 0x%03X %s, %d bytes%s\n' % (message.can_id, message.name, message.dlc, period))
+        out.write('const uint32_t ID = 0x%03X;\n' % message.can_id)
+        for s in sorted(message.signals, key=lambda s: s.start):
+            out.write(typedef_for(s) + '\n')
+        out.write('\n')
+
+
+def main():
+    root = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+    parser = argparse.ArgumentParser(description='DBC export and import for the cluster messages')
+    commands = parser.add_subparsers(dest='command')
+    commands.required = True
+
+    export = commands.add_parser('export', help='Write a DBC of the messages in the sketch')
+    export.add_argument('--ino', default=os.path.join(root, 'e90-can-cluster.ino'))
+    export.add_argument('-o', '--output', help='DBC file, stdout by default')
+    export.add_argument('-D', '--define', action='append', metavar='NAME[=VALUE]',
+                        help='Export with this config.h option, can be repeated')
+
+    load = commands.add_parser('import', help='Print the signal typedefs of the messages in a DBC')
+    load.add_argument('dbc')
+    load.add_argument('--id', action='append', help='Only this ID, can be repeated')
+
+    args = parser.parse_args()
+
+    if args.command == 'export':
+        with open(args.ino, encoding='utf-8') as f:
+            messages = parse_sketch(f.read(), *read_sketch(args.ino, args.define))
+        if args.output:
+            with open(args.output, 'w', encoding=DBC_ENCODING, newline='\n') as f:
+                write_dbc(messages, f)
+        else:
+            write_dbc(messages, sys.stdout)
+        return 0
+
+    with open(args.dbc, 'rb') as f:
+        data = f.read()
+    try:
+        text = data.decode('utf-8')
+    except UnicodeDecodeError:
+        text = data.decode(DBC_ENCODING)
+
+    messages = read_dbc(text)
+    if args.id:
+        wanted = {int(i, 0) for i in args.id}
+        messages = [m for m in messages if m.can_id in wanted]
+    write_typedefs(messages, sys.stdout)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,362 @@
+#!/usr/bin/env python3
+"""
+Offline schedulability analysis for the CAN messages sent by the sketch.
+
+Reads the periodic groups from canTick() in e90-can-cluster.ino (the
+`s_timers.canCounter % N == K` blocks and their queuePush() calls, pushes
+outside them run every tick) and the CAN ID and frame length of each pushed
+function. It then simulates the scheduler over the hyperperiod: the 10 ms
+tick, the FIFO task queue that skips tasks already queued and the TX gap
+between frames. Worst case every task sends a frame every time, except that
+a task with a `minTicks` constant sends at most once per minTicks ticks, in
+any phase. Its deadline is then the `keepAliveTicks` interval it sends at
+while the value is steady, faster frames while it changes are best effort.
+The sketch is read as compiled with config.h, -D adds options to it, e.g.
+-D USE_SPEED_HIGH_RATE -D SPEED_HIGH_RATE_MS=10.
+
+The response time of a frame is measured from the tick that queued it until
+its last bit is on the bus. The bus part uses the classic CAN response time
+analysis at the configured bitrate: one lower priority frame already on the
+bus blocks it, and higher priority cluster frames (--rx) can win the
+arbitration.
+
+Exit code is 1 if any frame misses its deadline (its period or keep-alive interval by default), the
+queue overflows or no scheduler groups are found.
+
+Usage:
+    python3 tools/can_schedule.py [--ino e90-can-cluster.ino] [--gap-us 3000]
+        [--adapter serial|mcp|twai] [--rx 0x330:200 ...] [--deadline 0x592:400 ...]
+        [-D USE_SPEED_HIGH_RATE ...]
+"""
+
+import argparse
+import math
+import os
+import re
+import sys
+from functools import reduce
+
+TICK_MS = 10
+QUEUE_SIZE = 64
+ERROR_LIGHT_ID = 0x592
+
+
+def frame_bits(dlc):
+    # Worst case bits on the wire of a standard frame including stuff bits and IFS
+    return 47 + 8 * dlc + (34 + 8 * dlc - 1) // 4
+
+
+def condition_value(expr, defines):
+    """Value of an #if expression: defined(), macros from defines, integer arithmetic and logic"""
+    expr = re.sub(r'defined\s*\(\s*(\w+)\s*\)|defined\s+(\w+)',
+                  lambda m: '1' if (m.group(1) or m.group(2)) in defines else '0', expr)
+    for _ in range(8):
+        expanded = re.sub(r'\b[A-Za-z_]\w*\b', lambda m: '(%s)' % (defines.get(m.group(0)) or '0'), expr)
+        if expanded == expr:
+            break
+        expr = expanded
+    expr = re.sub(r'\b(\d+)[uUlL]+\b', r'\1', expr)
+    expr = expr.replace('&&', ' and ').replace('||', ' or ').replace('/', '//')
+    expr = re.sub(r'!(?!=)', ' not ', expr)
+    try:
+        return int(eval(expr, {'__builtins__': {}}))
+    except Exception:
+        return 1  # Unknown constructs count as true, like the tools did before
+
+
+def preprocess(src, defines):
+    """Blanks the lines of inactive #if branches and adds the active #defines to defines"""
+    out = []
+    stack = []  # (parent active, branch taken)
+    active = True
+    for line in src.split('\n'):
+        m = re.match(r'\s*#\s*(ifdef|ifndef|if|elif|else|endif|define|undef)\b\s*(.*)', line)
+        directive, rest = (m.group(1), re.sub(r'//.*|/\*.*', '', m.group(2)).strip()) if m else (None, '')
+
+        if directive in ('ifdef', 'ifndef', 'if'):
+            if directive == 'if':
+                taken = bool(condition_value(rest, defines))
+            else:
+                taken = (rest.split()[0] in defines) == (directive == 'ifdef')
+            stack.append((active, taken))
+            active = active and taken
+        elif directive == 'elif' and stack:
+            parent, taken = stack[-1]
+            branch = not taken and bool(condition_value(rest, defines))
+            stack[-1] = (parent, taken or branch)
+            active = parent and branch
+        elif directive == 'else' and stack:
+            parent, taken = stack[-1]
+            stack[-1] = (parent, True)
+            active = parent and not taken
+        elif directive == 'endif' and stack:
+            active = stack.pop()[0]
+        elif directive == 'define' and active:
+            name = re.match(r'(\w+)(\([^)]*\))?\s*(.*)', rest)
+            if not name.group(2):
+                defines[name.group(1)] = name.group(3)
+        elif directive == 'undef' and active:
+            defines.pop(rest.split()[0], None)
+
+        out.append(line if active and not directive else '')
+    return '\n'.join(out)
+
+
+def read_sketch(ino, extra_defines=None):
+    """The sketch as compiled with config.h next to it and the -D overrides, comments kept"""
+    defines = {}
+    for define in extra_defines or []:
+        name, _, value = define.partition('=')
+        defines[name] = value or '1'
+    config = os.path.join(os.path.dirname(os.path.abspath(ino)), 'config.h')
+    if os.path.exists(config):
+        with open(config, encoding='utf-8') as f:
+            preprocess(f.read(), defines)
+    with open(ino, encoding='utf-8') as f:
+        return preprocess(f.read(), defines), defines
+
+
+def strip_comments(src):
+    src = re.sub(r'/\*.*?\*/', '', src, flags=re.S)
+    return re.sub(r'//[^\n]*', '', src)
+
+
+def block_at(src, start):
+    # Text between the brace at or after start and its matching closing brace
+    open_pos = src.index('{', start)
+    depth = 0
+    for i in range(open_pos, len(src)):
+        if src[i] == '{':
+            depth += 1
+        elif src[i] == '}':
+            depth -= 1
+            if depth == 0:
+                return src[open_pos + 1:i]
+    raise ValueError('Unbalanced braces')
+
+
+def parse_min_ticks(src):
+    """Function name -> (ticks between frames at least, ticks between frames while steady) for
+    the functions with a minTicks constant"""
+    min_ticks = {}
+    for m in re.finditer(r'^bool\s+(\w+)\s*\(\s*\)\s*\{', src, flags=re.M):
+        body = block_at(src, m.start())
+        found = re.search(r'const\s+uint8_t\s+minTicks\s*=\s*(\d+)', body)
+        keep_alive = re.search(r'const\s+uint8_t\s+keepAliveTicks\s*=\s*(\d+)', body)
+        if found and m.group(1) not in min_ticks:
+            ticks = int(found.group(1))
+            min_ticks[m.group(1)] = (ticks, int(keep_alive.group(1)) if keep_alive else ticks)
+    return min_ticks
+
+
+def parse_messages(src):
+    """Function name -> (CAN ID, DLC) for every function that can be queued"""
+    messages = {}
+
+    for m in re.finditer(r'^bool\s+(\w+)\s*\(\s*\)\s*\{', src, flags=re.M):
+        name = m.group(1)
+        if name in messages:
+            continue  # Alternatives under #else, the first one is the default
+        body = block_at(src, m.start())
+
+        if 'canSendErrorLight' in body:
+            messages[name] = (ERROR_LIGHT_ID, 8)
+            continue
+
+        id_match = re.search(r'const\s+uint32_t\s+ID\s*=\s*(0x[0-9A-Fa-f]+)', body)
+        if not id_match:
+            continue
+
+        dlc = 8
+        send = re.search(r'canSend\(\s*ID\s*,\s*\w+\s*,\s*sizeof\((\w+)\)\s*\)', body)
+        if send:
+            array = re.search(r'\b' + send.group(1) + r'\[(\d+)\]', body)
+            if array:
+                dlc = int(array.group(1))
+        messages[name] = (int(id_match.group(1), 16), dlc)
+
+    return messages
+
+
+def parse_groups(src, defines=None):
+    """List of (period in ticks, offset in ticks, [function names]) in scheduler order"""
+    start = re.search(r'^void\s+(canTick|canService)\s*\(\s*\)\s*\{', src, flags=re.M)
+    if not start:
+        start = re.search(r'^void\s+loop\s*\(\s*\)', src, flags=re.M)
+    loop = block_at(src, start.start())
+    groups = []
+    for m in re.finditer(r'if\s*\(\s*s_timers\.canCounter\s*%\s*(\d+|\([^)]*\))\s*==\s*(\d+)\s*\)', loop):
+        body = block_at(loop, m.end())
+        tasks = re.findall(r'queuePush\(\s*(\w+)\s*\)', body)
+        if tasks:
+            groups.append((m.start(), (condition_value(m.group(1), defines or {}), int(m.group(2)), tasks)))
+
+    # Pushes outside the blocks run on every tick
+    depth = 0
+    for i, c in enumerate(loop):
+        depth += (c == '{') - (c == '}')
+        m = re.match(r'queuePush\(\s*(\w+)\s*\)', loop[i:]) if depth == 0 and c == 'q' else None
+        if m:
+            groups.append((i, (1, 0, [m.group(1)])))
+    return [group for _, group in sorted(groups)]
+
+
+def bus_response_us(can_id, dlc, bit_us, rx, max_bits):
+    # Non-preemptive CAN: blocked by one frame already on the bus, then interfered by
+    # higher priority cluster frames until ours wins the arbitration
+    c = frame_bits(dlc) * bit_us
+    blocking = max_bits * bit_us
+    higher = [(frame_bits(8) * bit_us, period_ms * 1000) for rx_id, period_ms in rx if rx_id < can_id]
+
+    w = blocking
+    while True:
+        w_next = blocking + sum(math.ceil((w + bit_us) / t) * cj for cj, t in higher)
+        if w_next == w or w_next > 10 ** 9:
+            return w_next + c
+        w = w_next
+
+
+def simulate(groups, messages, gap_us, hyper_ticks, min_ticks, phase=0):
+    """Returns {function: [queueing delays in us]}, the deepest queue seen and whether it overflowed.
+    The tasks with min_ticks first send phase ticks in."""
+    queue = []
+    delays = {}
+    depth = 0
+    overflow = False
+    last_task_us = 0
+    sent_tick = {name: phase - n for name, (n, _) in min_ticks.items()}
+
+    for tick in range(hyper_ticks * 2):  # Second hyperperiod is the steady state
+        tick_us = tick * TICK_MS * 1000
+        for period, offset, tasks in groups:
+            if tick % period == offset:
+                for name in tasks:
+                    if any(queued == name for queued, _ in queue):
+                        continue
+                    if len(queue) < QUEUE_SIZE:
+                        queue.append((name, tick_us))
+                    else:
+                        overflow = True
+        depth = max(depth, len(queue))
+
+        # The gate pops one task per gap until the next tick
+        next_tick_us = tick_us + TICK_MS * 1000
+        t = max(tick_us, last_task_us + gap_us)
+        while queue and t < next_tick_us:
+            name, released = queue.pop(0)
+            if name in sent_tick:
+                # A call that sends nothing does not wait for the gap
+                if tick - sent_tick[name] < min_ticks[name][0]:
+                    continue
+                sent_tick[name] = tick
+            if tick >= hyper_ticks:
+                delays.setdefault(name, []).append(t - released)
+            last_task_us = t
+            t += gap_us
+
+    return delays, depth, overflow
+
+
+def parse_pairs(values):
+    pairs = []
+    for v in values or []:
+        can_id, ms = v.split(':')
+        pairs.append((int(can_id, 0), int(ms)))
+    return pairs
+
+
+def main():
+    root = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+    parser = argparse.ArgumentParser(description='CAN schedule worst-case response time analysis')
+    parser.add_argument('--ino', default=os.path.join(root, 'e90-can-cluster.ino'))
+    parser.add_argument('--bitrate', type=int, default=100000)
+    parser.add_argument('--gap-us', type=int, default=3000, help='Minimum time between queued frames')
+    parser.add_argument('--adapter', choices=['serial', 'mcp', 'twai'], default='serial',
+                        help='The serial adapter always sends 8 data bytes')
+    parser.add_argument('--rx', action='append', metavar='ID:PERIOD_MS',
+                        help='Cluster frame on the bus, can be repeated')
+    parser.add_argument('-D', '--define', action='append', metavar='NAME[=VALUE]',
+                        help='Analyse with this config.h option, can be repeated')
+    parser.add_argument('--deadline', action='append', metavar='ID:MS',
+                        help='Deadline other than the period for an ID, can be repeated')
+    args = parser.parse_args()
+
+    raw, defines = read_sketch(args.ino, args.define)
+    src = strip_comments(raw)
+
+    messages = parse_messages(src)
+    min_ticks = parse_min_ticks(src)
+    groups = parse_groups(src, defines)
+    rx = parse_pairs(args.rx)
+    deadlines = dict(parse_pairs(args.deadline))
+    bit_us = 1e6 / args.bitrate
+
+    if not any(tasks for _, _, tasks in groups):
+        print('No scheduler groups with queuePush() calls found in %s' % args.ino)
+        return 1
+
+    unknown = sorted({name for _, _, tasks in groups for name in tasks if name not in messages})
+    if unknown:
+        print('Cannot find the CAN ID of: ' + ', '.join(unknown))
+        return 1
+
+    if args.adapter == 'serial':
+        messages = {name: (can_id, 8) for name, (can_id, _) in messages.items()}
+
+    hyper_ticks = reduce(lambda a, b: a * b // math.gcd(a, b), [p for p, _, _ in groups], 1)
+    max_bits = max([frame_bits(dlc) for _, dlc in messages.values()] + [frame_bits(8) if rx else 0])
+    delays, depth, overflow = {}, 0, False
+    for phase in range(max([n for n, _ in min_ticks.values()] + [1])):
+        phase_delays, phase_depth, phase_overflow = simulate(groups, messages, args.gap_us, hyper_ticks,
+                                                             min_ticks, phase)
+        for name, values in phase_delays.items():
+            delays.setdefault(name, []).extend(values)
+        depth = max(depth, phase_depth)
+        overflow |= phase_overflow
+
+    # Worst case per queued function, several of them can share an ID (e.g. 0x592)
+    rows = {}
+    for period, _, tasks in groups:
+        for name in tasks:
+            can_id, dlc = messages[name]
+            bus_us = bus_response_us(can_id, dlc, bit_us, rx, max_bits)
+            worst = max(delays[name]) + bus_us
+            best = min(delays[name]) + frame_bits(dlc) * bit_us
+            fastest, steady = min_ticks.get(name, (period, period))
+            fastest = -(-fastest // period) * period  # Sent on the calls only
+            row = rows.setdefault((can_id, name), {'dlc': dlc, 'period': fastest * TICK_MS,
+                                                   'deadline': steady * TICK_MS, 'worst': 0, 'best': worst})
+            row['period'] = min(row['period'], fastest * TICK_MS)
+            row['deadline'] = min(row['deadline'], steady * TICK_MS)
+            row['worst'] = max(row['worst'], worst)
+            row['best'] = min(row['best'], best)
+
+    load_bits = sum(frame_bits(messages[name][1]) * 1000 / (max(period, min_ticks.get(name, (0, 0))[0]) * TICK_MS)
+                    for period, _, tasks in groups for name in tasks)
+    load_bits += sum(frame_bits(8) * 1000 / period_ms for _, period_ms in rx)
+
+    print('Hyperperiod %d ms, TX gap %d us, %d bit/s, %s adapter'
+          % (hyper_ticks * TICK_MS, args.gap_us, args.bitrate, args.adapter))
+    print('Worst case bus load %.1f %%, deepest queue %d of %d\n'
+          % (100.0 * load_bits / args.bitrate, depth, QUEUE_SIZE))
+    print('   ID  DLC  Period ms  Deadline ms  WCRT ms  Jitter ms  Result  Sender')
+
+    failed = overflow
+    for can_id, name in sorted(rows):
+        row = rows[(can_id, name)]
+        deadline = deadlines.get(can_id, row['deadline'])
+        ok = row['worst'] <= deadline * 1000
+        failed |= not ok
+        print('0x%03X  %3d  %9d  %11d  %7.2f  %9.2f  %-6s  %s'
+              % (can_id, row['dlc'], row['period'], deadline, row['worst'] / 1000.0,
+                 (row['worst'] - row['best']) / 1000.0, 'OK' if ok else 'MISS', name))
+
+    if overflow:
+        print('\nTask queue overflows, frames are dropped')
+
+    print('\n' + ('INFEASIBLE' if failed else 'Schedulable'))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+"""
+Fuel gauge calibration against a real cluster, needs USE_FUEL_CALIBRATION in
+config.h and the custom binary API.
+
+sweep  Steps both 0x349 sensor levels across a range. The firmware waits at
+       each step until the tank readings the cluster reports in 0x330 settle
+       and records them. The samples are saved as CSV.
+dump   Saves the samples of the last sweep again.
+fit    Fits a gauge curve per sensor to the samples: for each fuel level the
+       sensor value at which the cluster's reading is that fraction of its
+       range. Samples that timed out before settling are left out. Prints
+       the FuelTable initializers for the sketch.
+load   Fits the samples and loads the curves into the running firmware, they
+       last until the next reset.
+
+Usage:
+    python3 tools/fuel_calibrate.py sweep --port /dev/ttyACM0 [--from 500 --to 10000 --steps 32] [-o fuel.csv]
+    python3 tools/fuel_calibrate.py dump --port /dev/ttyACM0 [-o fuel.csv]
+    python3 tools/fuel_calibrate.py fit fuel.csv [--points 16]
+    python3 tools/fuel_calibrate.py load --port /dev/ttyACM0 fuel.csv [--points 16]
+"""
+
+import argparse
+import csv
+import re
+import struct
+import sys
+import time
+
+FRAME_LENGTH = 35  # Same as the 'S' frame
+FUEL_FULL = 1000
+FUEL_METER_LEVEL_MAX = 10000
+TABLE_CHUNK = 7
+
+CMD_SWEEP = 1
+CMD_STOP = 2
+CMD_DUMP = 3
+CMD_TABLE = 4
+
+SAMPLE_RE = re.compile(r'\[FUELCAL\] sample (\d+) level (\d+) left (\d+) right (\d+) fuel (\d+) (\w+)')
+
+
+def command_frame(command, payload=b''):
+    body = bytes([command]) + payload.ljust(FRAME_LENGTH - 3, b'\0')
+    return b'C' + body + bytes([sum(body) & 0xFF])
+
+
+def open_port(port, baud):
+    try:
+        import serial
+    except ImportError:
+        sys.exit('pyserial is needed: pip install pyserial')
+    # Opening the port resets most boards, wait for the sketch to start
+    link = serial.Serial(port, baud, timeout=1)
+    time.sleep(2)
+    link.reset_input_buffer()
+    return link
+
+
+def read_line(link):
+    return link.readline().decode('ascii', errors='replace').strip()
+
+
+def collect(link, output):
+    """Reads [FUELCAL] sample lines until the firmware reports the end and saves them"""
+    samples = []
+    try:
+        while True:
+            line = read_line(link)
+            if not line.startswith('[FUELCAL]'):
+                continue
+            print(line)
+            m = SAMPLE_RE.match(line)
+            if m:
+                samples.append([int(v) for v in m.groups()[1:5]] + [m.group(6) == 'settled'])
+            elif 'rejected' in line or ' done ' in line or 'stopped' in line:
+                break
+    except KeyboardInterrupt:
+        link.write(command_frame(CMD_STOP))
+
+    with open(output, 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(['level', 'left', 'right', 'fuel', 'settled'])
+        writer.writerows([s[:4] + [int(s[4])] for s in samples])
+
+    unsettled = sum(1 for s in samples if not s[4])
+    print('%d samples written to %s%s' % (len(samples), output,
+          ', %d timed out before settling' % unsettled if unsettled else ''))
+    return 0 if samples else 1
+
+
+def sweep(args):
+    if not 2 <= args.steps <= 255:
+        sys.exit('--steps must be 2-255 and at most FUEL_CALIBRATION_MAX_SAMPLES')
+    if not (0 <= args.level_from <= FUEL_METER_LEVEL_MAX and 0 <= args.level_to <= FUEL_METER_LEVEL_MAX):
+        sys.exit('--from and --to must be 0-%d (FUEL_METER_LEVEL_MAX)' % FUEL_METER_LEVEL_MAX)
+
+    link = open_port(args.port, args.baud)
+    link.write(command_frame(CMD_SWEEP, struct.pack('<HHB', args.level_from, args.level_to, args.steps)))
+    return collect(link, args.output)
+
+
+def dump(args):
+    # Boards that reset when the port opens have lost the samples, this is for the native USB ones
+    link = open_port(args.port, args.baud)
+    link.write(command_frame(CMD_DUMP))
+    return collect(link, args.output)
+
+
+def read_samples(path):
+    with open(path, newline='') as f:
+        return [{k: int(v) for k, v in row.items()} for row in csv.DictReader(f)]
+
+
+def fit_side(samples, side, points):
+    """[(fuel per mille, sensor level)] from full to empty for one sensor"""
+    pairs = sorted((s['level'], s[side]) for s in samples)
+    levels = [p[0] for p in pairs]
+
+    # Filtering noise can make a reading dip, the cluster's response is monotonic
+    readings = []
+    for _, reading in pairs:
+        readings.append(max(reading, readings[-1]) if readings else reading)
+
+    low, high = readings[0], readings[-1]
+    if high <= low:
+        sys.exit('The %s reading does not change over the sweep' % side)
+
+    curve = []
+    for i in range(points):
+        fuel = FUEL_FULL - FUEL_FULL * i // (points - 1)
+        target = low + (high - low) * fuel / FUEL_FULL
+        level = levels[-1]
+        for j in range(1, len(levels)):
+            if readings[j] >= target:
+                # Lowest sensor level that reaches the target, linear within the step
+                span = readings[j] - readings[j - 1]
+                part = (target - readings[j - 1]) / span if span else 0.0
+                level = levels[j - 1] + (levels[j] - levels[j - 1]) * part
+                break
+        if fuel == 0:
+            level = levels[0]
+        curve.append((fuel, int(round(level))))
+    return curve
+
+
+def fit_curves(args):
+    samples = read_samples(args.samples)
+    # A step that timed out was recorded while the gauge was still moving
+    settled = [s for s in samples if s['settled']]
+    if len(settled) < len(samples):
+        print('Ignoring %d samples that timed out before settling' % (len(samples) - len(settled)), file=sys.stderr)
+    if len(settled) < 2:
+        sys.exit('Not enough settled samples in %s' % args.samples)
+    samples = settled
+    if args.points < 2 or args.points > 255:
+        sys.exit('--points must be 2-255 and at most FUEL_TABLE_MAX_POINTS')
+    return fit_side(samples, 'left', args.points), fit_side(samples, 'right', args.points)
+
+
+def print_table(name, curve):
+    print('FuelTable %s = {{' % name)
+    print(',\n'.join('    fuelPoint(%.3ff, %d)' % (fuel / float(FUEL_FULL), level) for fuel, level in curve))
+    print('}, %d};\n' % len(curve))
+
+
+def fit(args):
+    left, right = fit_curves(args)
+    print_table('fuelTableLeft', left)
+    print_table('fuelTableRight', right)
+    return 0
+
+
+def load(args):
+    left, right = fit_curves(args)
+    link = open_port(args.port, args.baud)
+
+    failed = False
+    for side, curve in enumerate((left, right)):
+        for first in range(0, len(curve), TABLE_CHUNK):
+            chunk = curve[first:first + TABLE_CHUNK]
+            payload = struct.pack('<BBBB', side, first, len(chunk), len(curve))
+            payload += b''.join(struct.pack('<HH', fuel, level) for fuel, level in chunk)
+            link.write(command_frame(CMD_TABLE, payload))
+
+        while True:
+            line = read_line(link)
+            if not line:
+                print('No answer for the %s curve' % ('right' if side else 'left'))
+                failed = True
+                break
+            if line.startswith('[FUELCAL]'):
+                print(line)
+                failed |= 'rejected' in line
+                break
+
+    return 1 if failed else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Fuel gauge calibration sweep and curve fit')
+    commands = parser.add_subparsers(dest='command')
+    commands.required = True
+
+    port = argparse.ArgumentParser(add_help=False)
+    port.add_argument('--port', required=True)
+    port.add_argument('--baud', type=int, default=921600, help='PC_SERIAL_BAUD')
+
+    curve = argparse.ArgumentParser(add_help=False)
+    curve.add_argument('samples', help='CSV written by sweep')
+    curve.add_argument('--points', type=int, default=16, help='Curve points, at most FUEL_TABLE_MAX_POINTS')
+
+    p = commands.add_parser('sweep', parents=[port], help='Record the cluster response')
+    p.add_argument('--from', dest='level_from', type=int, default=500)
+    p.add_argument('--to', dest='level_to', type=int, default=10000)
+    p.add_argument('--steps', type=int, default=32, help='At most FUEL_CALIBRATION_MAX_SAMPLES')
+    p.add_argument('-o', '--output', default='fuel_calibration.csv')
+    p.set_defaults(func=sweep)
+
+    p = commands.add_parser('dump', parents=[port], help='Save the samples of the last sweep again')
+    p.add_argument('-o', '--output', default='fuel_calibration.csv')
+    p.set_defaults(func=dump)
+
+    p = commands.add_parser('fit', parents=[curve], help='Print the fitted curves for the sketch')
+    p.set_defaults(func=fit)
+
+    p = commands.add_parser('load', parents=[port, curve], help='Load the fitted curves without reflashing')
+    p.set_defaults(func=load)
+
+    args = parser.parse_args()
+    return args.func(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
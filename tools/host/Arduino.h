@@ -0,0 +1,83 @@
+#pragma once
+
+// Just enough of the Arduino core to build the sketch on the host, see tools/builder_equivalence.py
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <type_traits>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define A0 14
+#define LED_BUILTIN 13
+
+#define PROGMEM
+#define F(x) (x)
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#define pgm_read_ptr(p) (*(void* const*)(p))
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+template<class A, class B> inline typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+template<class A, class B> inline typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int analogRead(uint8_t pin);
+void randomSeed(unsigned long seed);
+long random(long max);
+long random(long min, long max);
+
+void noInterrupts();
+void interrupts();
+
+class String : public std::string {
+public:
+    String() {}
+    String(const char* text) : std::string(text) {}
+    String(const std::string& text) : std::string(text) {}
+    long toInt() const { return atol(c_str()); }
+    String& operator+=(char c) { push_back(c); return *this; }
+};
+
+class Stream {
+public:
+    void begin(unsigned long baud);
+    void end();
+    int available();
+    int read();
+    int peek();
+    void flush();
+    int availableForWrite();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* data, size_t len);
+    size_t write(const char* text);
+    size_t print(const char* text);
+    size_t print(char c);
+    size_t print(const String& text);
+    size_t print(int value);
+    size_t println(const char* text);
+    size_t println();
+    explicit operator bool() const { return true; }
+};
+
+extern Stream Serial;
+extern Stream Serial1;
@@ -0,0 +1,96 @@
+// Runs the sketch on the host against a simulated clock and serial input and prints every
+// CAN frame it sends, see tools/builder_equivalence.py
+//
+// Built together with the sketch and its .cpp files, the CAN adapters are replaced by the
+// functions below. Two builds given the same seed see exactly the same input at the same
+// times, so their output only differs where the frames they build do.
+
+#include <Arduino.h>
+#include <random>
+#include "can_adapter.h"
+#include "serial_binary.h"
+
+void setup();
+void loop();
+
+static uint64_t clock_us = 0;
+
+unsigned long millis() { return (unsigned long)(clock_us / 1000); }
+unsigned long micros() { return (unsigned long)clock_us; }
+void delay(unsigned long ms) { clock_us += ms * 1000ULL; }
+void delayMicroseconds(unsigned int us) { clock_us += us; }
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int analogRead(uint8_t) { return 0; }
+void randomSeed(unsigned long) {}
+long random(long max) { return max > 0 ? rand() % max : 0; }
+long random(long min, long max) { return min + random(max - min); }
+void noInterrupts() {}
+void interrupts() {}
+
+// Serial carries the frames from the PC, nothing written to it is checked
+static uint8_t input[SERIAL_FRAME_LENGTH];
+static size_t input_pos = SERIAL_FRAME_LENGTH;
+
+void Stream::begin(unsigned long) {}
+void Stream::end() {}
+int Stream::available() { return this == &Serial ? (int)(SERIAL_FRAME_LENGTH - input_pos) : 0; }
+int Stream::read() { return available() ? input[input_pos++] : -1; }
+int Stream::peek() { return available() ? input[input_pos] : -1; }
+void Stream::flush() {}
+int Stream::availableForWrite() { return 64; }
+size_t Stream::write(uint8_t) { return 1; }
+size_t Stream::write(const uint8_t*, size_t len) { return len; }
+size_t Stream::write(const char* text) { return strlen(text); }
+size_t Stream::print(const char* text) { return strlen(text); }
+size_t Stream::print(char) { return 1; }
+size_t Stream::print(const String& text) { return text.size(); }
+size_t Stream::print(int) { return 1; }
+size_t Stream::println(const char* text) { return strlen(text) + 1; }
+size_t Stream::println() { return 1; }
+
+Stream Serial;
+Stream Serial1;
+
+void canBegin(const CanHandlerEntry*, size_t) {}
+void canPoll(CanFrameDispatch) {}
+
+void canSend(uint32_t id, const uint8_t* data, uint8_t len) {
+    printf("%llu %03X", (unsigned long long)(clock_us / 1000), (unsigned)id);
+    for (uint8_t i = 0; i < len; ++i) {
+        printf(" %02X", data[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    unsigned long seed = argc > 1 ? strtoul(argv[1], 0, 10) : 1;
+    unsigned long seconds = argc > 2 ? strtoul(argv[2], 0, 10) : 600;
+    std::mt19937 rng(seed);
+
+    uint8_t payload[SERIAL_FRAME_LENGTH] = {'S'};
+    uint64_t next_frame_us = 0;
+
+    setup();
+    while (clock_us < seconds * 1000000ULL) {
+        if (clock_us >= next_frame_us && input_pos == SERIAL_FRAME_LENGTH) {
+            // A few values change per frame so the builders see both held and changing input
+            for (uint32_t n = rng() % 4; n > 0; --n) {
+                payload[1 + rng() % (SERIAL_FRAME_LENGTH - 2)] = (uint8_t)rng();
+            }
+            uint8_t checksum = 0;
+            for (size_t i = 1; i < SERIAL_FRAME_LENGTH - 1; ++i) {
+                checksum += payload[i];
+            }
+            payload[SERIAL_FRAME_LENGTH - 1] = checksum;
+            memcpy(input, payload, sizeof(input));
+            input_pos = 0;
+            next_frame_us = clock_us + 5000 + rng() % 95000;
+        }
+
+        loop();
+        clock_us += 100 + rng() % 400;
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""
+Host model of the USE_NEEDLE_LEAD gauge lead.
+
+Runs the integer arithmetic of NeedleLead in types.h as canSendRPM() and
+canSendSpeed() call it, against a cluster needle modelled as a first-order
+lag of the configured time constant behind the value on the bus. For a step
+of the input it prints when that needle reaches 90% of the step with and
+without the lead, and how far it overshoots.
+
+The model needle and the real one only match when the lag is measured for
+the cluster, see NEEDLE_RPM_LAG_MS in config.h.
+
+Usage:
+    python3 tools/needle_lead.py [--gain 2] [--rpm-lag-ms 150] [--speed-lag-ms 250]
+"""
+
+import argparse
+import sys
+
+MAX_RPM = 8000
+MAX_SPEED = 2800  # MAX_SPEED_KMH_X10
+
+
+def c_div(a, b):
+    """Integer division that truncates toward zero like C"""
+    q = abs(a) // abs(b)
+    return q if (a >= 0) == (b > 0) else -q
+
+
+class NeedleLead:
+    """NeedleLead in types.h"""
+
+    def __init__(self, needle=0):
+        self.needle = needle << 4  # 4 fraction bits
+
+    def apply(self, target, lag_ms, gain, max_lead, max_value):
+        if lag_ms == 0:
+            return target
+        lead = (target - (self.needle >> 4)) * gain
+        lead = max(-max_lead, min(max_lead, lead))
+        return max(0, min(max_value, target + lead))
+
+    def follow(self, sent, interval_ms, lag_ms):
+        if interval_ms == 0:
+            return
+        tau = max(lag_ms, interval_ms)
+        self.needle += c_div(((sent << 4) - self.needle) * interval_ms, tau)
+
+
+def step_response(start, end, period_ms, lag_ms, gain, max_lead, max_value, duration_ms=3000):
+    """(ms until the cluster needle covers 90% of the step or None, largest overshoot)"""
+    lead = NeedleLead(start)
+    needle = float(start)
+    t90 = None
+    overshoot = 0.0
+    for t in range(period_ms, duration_ms + period_ms, period_ms):
+        sent = lead.apply(end, lag_ms, gain, max_lead, max_value) if gain else end
+        lead.follow(sent, period_ms, lag_ms)
+        needle += (sent - needle) * period_ms / float(lag_ms)
+        overshoot = max(overshoot, (needle - end) * (1 if end >= start else -1))
+        if t90 is None and abs(needle - start) >= 0.9 * abs(end - start):
+            t90 = t
+    return t90, overshoot
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Step response of the needle lead')
+    parser.add_argument('--gain', type=int, default=2, help='NEEDLE_LEAD_GAIN')
+    parser.add_argument('--rpm-lag-ms', type=int, default=150, help='NEEDLE_RPM_LAG_MS')
+    parser.add_argument('--rpm-max-lead', type=int, default=1500, help='NEEDLE_RPM_MAX_LEAD')
+    parser.add_argument('--speed-lag-ms', type=int, default=250, help='NEEDLE_SPEED_LAG_MS')
+    parser.add_argument('--speed-max-lead', type=int, default=150, help='NEEDLE_SPEED_MAX_LEAD')
+    args = parser.parse_args()
+
+    steps = [
+        ('RPM', 800, 6000, 20, args.rpm_lag_ms, args.rpm_max_lead, MAX_RPM),
+        ('RPM', 6000, 800, 20, args.rpm_lag_ms, args.rpm_max_lead, MAX_RPM),
+        ('Speed', 0, 1000, 50, args.speed_lag_ms, args.speed_max_lead, MAX_SPEED),
+        ('Speed', 1000, 500, 50, args.speed_lag_ms, args.speed_max_lead, MAX_SPEED),
+    ]
+
+    print('Needle    Step          Period ms  90%% no lead  90%% gain %d  Overshoot' % args.gain)
+    for name, start, end, period, lag, max_lead, max_value in steps:
+        if lag == 0:
+            print('%-8s  %5d-%-5d  lead off' % (name, start, end))
+            continue
+        plain, _ = step_response(start, end, period, lag, 0, max_lead, max_value)
+        led, overshoot = step_response(start, end, period, lag, args.gain, max_lead, max_value)
+        print('%-8s  %5d-%-5d  %9d  %11s  %11s  %9.1f' % (name, start, end, period,
+              '%d ms' % plain if plain else '-', '%d ms' % led if led else '-', overshoot))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+"""
+Long-run simulation of the 0x1A6 distance and tick counters.
+
+Runs the integer arithmetic of canSendSpeed() and speedIncrement() with
+32-bit wrap-around, as the firmware does, for every call period given. The
+calls come at the period plus a random delay in the queue up to --jitter-ms,
+with an occasional stall of the main loop. micros() wraps every ~72 minutes
+like on the board. The game's speed changes at random times, held in between.
+
+Checked after every call:
+- no pulse is lost to rounding or overflow: pulses counted * 4000000 plus the
+  accumulator equals the exact sum of speed * (1360 - calibration) * ticks
+- no time is lost: the ticks counted trail the real time by less than one
+  0.25 ms tick and Tick in the frame matches them modulo 4096
+- one frame never advances Distance by half the 16-bit range or more, so the
+  cluster can always tell the difference
+
+At the end it compares the distance with the exact integral of the speed,
+the only difference is where a speed change falls inside a call interval.
+
+With --lead the speed sent runs ahead of the input like USE_NEEDLE_LEAD
+does it (see tools/needle_lead.py), so the counters follow the sent speed.
+The distance the lead adds or takes is paid back at NEEDLE_SPEED_REPAY. The
+run then ends with ten minutes at a steady speed, after which the distance
+has to be within one pulse of the input's.
+
+Usage:
+    python3 tools/odometer_check.py [--period-ms 10 20 50 100] [--hours 24]
+        [--jitter-ms 25] [--calibration 60] [--seed 1] [--lead]
+"""
+
+import argparse
+import random
+import sys
+
+from needle_lead import NeedleLead, c_div
+
+U32 = 0xFFFFFFFF
+DIVISOR = 4000000
+MAX_STEP_TICKS = 1000  # SPEED_INCREMENT_MAX_TICKS
+MAX_SPEED = 2800       # MAX_SPEED_KMH_X10
+US_PER_TICK = 250
+SPEED_LAG_MS = 250     # NEEDLE_SPEED_LAG_MS
+LEAD_GAIN = 2          # NEEDLE_LEAD_GAIN
+SPEED_MAX_LEAD = 150   # NEEDLE_SPEED_MAX_LEAD
+SPEED_REPAY = 5        # NEEDLE_SPEED_REPAY
+HOLD_US = 600 * 1000000
+
+
+def speed_profile(seed, end_us, hold_us=0):
+    """[(time us, speed 0.1 km/h)] with changes every 10 ms to 2 s, then hold_us at 80 km/h"""
+    rng = random.Random(seed)
+    changes = []
+    t = 0
+    speed = 0
+    while t < end_us - hold_us:
+        changes.append((t, speed))
+        t += rng.randint(10000, 2000000)
+        if rng.random() < 0.02:
+            speed = 0  # Stops and parking-lot crawling
+        elif speed < 100 and rng.random() < 0.3:
+            speed = rng.randint(1, 100)
+        else:
+            speed = max(0, min(MAX_SPEED, speed + rng.randint(-150, 150)))
+    if hold_us:
+        changes.append((end_us - hold_us, 800))
+    return changes
+
+
+def exact_pulses_x(changes, end_us, calibration):
+    """Integral of the speed profile up to end_us, in pulses * DIVISOR * US_PER_TICK"""
+    total = 0
+    for i, (t, speed) in enumerate(changes):
+        if t >= end_us:
+            break
+        until = min(changes[i + 1][0] if i + 1 < len(changes) else end_us, end_us)
+        total += speed * (1360 - calibration) * (until - t)
+    return total
+
+
+def simulate(period_ms, changes, end_us, calibration, jitter_ms, seed, lead):
+    rng = random.Random(seed * 7919 + period_ms)
+    accumulator = 0
+    counter = 0          # Unwrapped, the frame carries it modulo 65536
+    tick_counter = 0     # 12 bits in the frame
+    exact = 0            # Sum of sent speed * (1360 - calibration) * ticks, unbounded
+    exact_input = 0      # The same for the input speed
+    model = NeedleLead()
+    lead_distance = 0    # Sum of (sent - input speed) * ticks like canSendSpeed()
+    max_lead_distance = 0
+    ticks_total = 0
+    max_frame_pulses = 0
+
+    start_us = rng.randint(0, U32)  # micros() at boot, wraps during the run
+    last_us = start_us
+    change = 0
+    scheduled = 0
+    real = 0
+    calls = 0
+
+    while True:
+        scheduled += period_ms * 1000
+        real = max(scheduled + rng.randint(0, jitter_ms * 1000), real)  # The queue keeps the order
+        if rng.random() < 0.0005:
+            # Blocking I2C, serial or adapter retries, the 10 ms tick restarts after them
+            real += rng.randint(100000, 600000)
+            scheduled = real
+        if real > end_us:
+            break
+
+        while change + 1 < len(changes) and changes[change + 1][0] <= real:
+            change += 1
+        speed = changes[change][1]
+
+        now_us = (start_us + real) & U32
+        ticks = ((now_us - last_us) & U32) // US_PER_TICK
+        last_us = (last_us + ticks * US_PER_TICK) & U32
+
+        sent = speed
+        if lead:
+            if ticks < 4000:
+                repay = 0
+                if speed > 0 and ticks > 0:
+                    repay = max(-SPEED_REPAY, min(SPEED_REPAY, c_div(lead_distance, ticks)))
+                led = model.apply(speed, SPEED_LAG_MS, LEAD_GAIN, SPEED_MAX_LEAD, MAX_SPEED)
+                sent = max(0, min(MAX_SPEED, led - repay))
+                lead_distance += (sent - speed) * ticks
+                if abs(lead_distance) >= 2 ** 31:
+                    raise AssertionError('lead distance overflow at %d ms' % (real // 1000))
+                max_lead_distance = max(max_lead_distance, abs(lead_distance))
+            else:
+                led = speed
+            model.follow(led, min(ticks // 4, 1000), SPEED_LAG_MS)
+
+        pulses = 0
+        remaining = ticks
+        while remaining > 0:
+            step = min(remaining, MAX_STEP_TICKS)
+            accumulator += sent * (1360 - calibration) * step
+            if accumulator > U32:
+                raise AssertionError('accumulator overflow at %d ms' % (real // 1000))
+            pulses += accumulator // DIVISOR
+            accumulator %= DIVISOR
+            remaining -= step
+
+        counter += pulses
+        tick_counter = (tick_counter + ticks) & 0xFFF
+        exact += sent * (1360 - calibration) * ticks
+        exact_input += speed * (1360 - calibration) * ticks
+        ticks_total += ticks
+        max_frame_pulses = max(max_frame_pulses, pulses)
+        calls += 1
+
+        if counter * DIVISOR + accumulator != exact:
+            raise AssertionError('pulses lost at %d ms' % (real // 1000))
+        if not 0 <= real - ticks_total * US_PER_TICK < US_PER_TICK:
+            raise AssertionError('time lost at %d ms' % (real // 1000))
+        if tick_counter != ticks_total % 4096:
+            raise AssertionError('Tick out of step at %d ms' % (real // 1000))
+        if max_frame_pulses >= 32768:
+            raise AssertionError('Distance step too large for the 16-bit counter')
+        if exact - exact_input != lead_distance * (1360 - calibration):
+            raise AssertionError('lead distance out of step at %d ms' % (real // 1000))
+
+    if lead and abs(exact - exact_input) >= DIVISOR:
+        raise AssertionError('lead distance of %.1f pulses not paid back'
+                             % ((exact - exact_input) / float(DIVISOR)))
+
+    integral = exact_pulses_x(changes, ticks_total * US_PER_TICK, calibration) / float(DIVISOR * US_PER_TICK)
+    return calls, counter, integral, max_frame_pulses, max_lead_distance
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Long-run simulation of the 0x1A6 odometer counters')
+    parser.add_argument('--period-ms', type=int, nargs='+', default=[10, 20, 50, 100])
+    parser.add_argument('--hours', type=float, default=24)
+    parser.add_argument('--jitter-ms', type=int, default=25, help='Queue delay, see tools/can_schedule.py')
+    parser.add_argument('--calibration', type=int, default=60, help='SPEED_CALIBRATION')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--lead', action='store_true', help='USE_NEEDLE_LEAD')
+    args = parser.parse_args()
+
+    end_us = int(args.hours * 3600e6)
+    changes = speed_profile(args.seed, end_us, HOLD_US if args.lead else 0)
+    print('%.1f h, %d speed changes, jitter up to %d ms, calibration %d%s\n'
+          % (args.hours, len(changes), args.jitter_ms, args.calibration, ', needle lead' if args.lead else ''))
+    print('Period ms      Calls      Pulses    Integral  Difference  Max per call  Max lead pulses')
+
+    for period in args.period_ms:
+        try:
+            calls, counter, integral, max_pulses, max_lead = simulate(period, changes, end_us, args.calibration,
+                                                                      args.jitter_ms, args.seed, args.lead)
+        except AssertionError as e:
+            print('%9d  FAIL: %s' % (period, e))
+            return 1
+        print('%9d  %9d  %10d  %10.1f  %+10.1f  %12d  %15.1f'
+              % (period, calls, counter, integral, counter - integral, max_pulses,
+                 max_lead * (1360 - args.calibration) / float(DIVISOR)))
+
+    print('\nExact: no pulse or tick lost in any call%s'
+          % (', the lead paid back within one pulse' if args.lead else ''))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "config.h"
+
 enum INDICATOR {
     I_OFF = 0,
     I_LEFT,
@@ -98,23 +100,123 @@ enum ErrorLightID : uint16_t {
     CHECKERED_FLAG = 446
 };
 
+// Groups of SInput fields, set in SInput::dirty by the parsers when a value changes
+// and read by the frame builders to skip re-encoding, see input_cache.h
+enum INPUT_FIELD : uint32_t {
+    IN_IGNITION       = 1UL << 0,  // ignition, engine_running
+    IN_TIME           = 1UL << 1,
+    IN_RPM            = 1UL << 2,
+    IN_SPEED          = 1UL << 3,
+    IN_GEAR           = 1UL << 4,  // currentGear, explicitGear, mode
+    IN_FUEL           = 1UL << 5,
+    IN_FUEL_INJECTION = 1UL << 6,
+    IN_TEMPS          = 1UL << 7,  // water_temp, oil_temp
+    IN_CUSTOM_LIGHT   = 1UL << 8,
+    IN_LIGHTS         = 1UL << 9,  // light_shift, _highbeam, _lowbeam, _fog, _beacon
+    IN_ASSISTS        = 1UL << 10, // light_tc_*, light_esc_*
+    IN_WARNINGS       = 1UL << 11, // the other warning symbols
+    IN_AMBIENT        = 1UL << 12,
+    IN_TIRES          = 1UL << 13,
+    IN_DOORS          = 1UL << 14,
+    IN_HANDBRAKE      = 1UL << 15,
+    IN_CRUISE         = 1UL << 16,
+    IN_INDICATOR      = 1UL << 17
+};
+
+// SInput::fuel of a full tank
+#define FUEL_FULL 1000
+
+// Range of the 0x349 sensor levels the gauge responds to
+#define FUEL_METER_LEVEL_MAX 10000
+
 struct FuelLevelPoint {
-    float fuel_percent;  // 1.0 = 100%, 0.75 = 75%, etc.
+    uint16_t fuel;        // Per mille like SInput::fuel, FUEL_FULL = 100%
     uint16_t meter_level; // Value to send to the cluster
 };
 
+// Gauge curve from full to empty, a denser one can be loaded at runtime (see fuel_calibration.h)
+struct FuelTable {
+    FuelLevelPoint points[FUEL_TABLE_MAX_POINTS];
+    uint8_t size;
+};
+
 struct STimers {
     uint32_t lastTime = 0;
     uint32_t lastTaskTime = 0;
     uint16_t canCounter = 0;
 };
 
+// For frames queued more often than they are sent. Intervals are in the units of now, e.g.
+// scheduler ticks or calls: due min_interval after the last frame while the value moves by at
+// least step since then, otherwise max_interval after it
+struct AdaptiveRate {
+    uint16_t last = 0;
+    uint16_t sent_at = 0;
+
+    bool due(uint16_t value, uint16_t step, uint16_t now, uint16_t min_interval, uint16_t max_interval) {
+        uint16_t elapsed = now - sent_at;
+        if (elapsed < min_interval) {
+            return false;
+        }
+        uint16_t delta = value > last ? value - last : last - value;
+        if (delta < step && elapsed < max_interval) {
+            return false;
+        }
+        last = value;
+        sent_at = now;
+        return true;
+    }
+};
+
+// Lead for a gauge needle modelled as a first-order lag of lag_ms behind the value on the bus.
+// The value sent overshoots the target by gain times the modelled needle error, at most max_lead,
+// so the modelled needle settles gain + 1 times faster. A lag of 0 turns it off.
+struct NeedleLead {
+    int32_t needle = 0;  // Modelled position, 4 fraction bits
+
+    uint16_t apply(uint16_t target, uint16_t lag_ms, uint8_t gain, uint16_t max_lead, uint16_t max_value) const {
+        if (lag_ms == 0) {
+            return target;
+        }
+        int32_t lead = ((int32_t)target - (needle >> 4)) * gain;
+        lead = lead > max_lead ? max_lead : (lead < -(int32_t)max_lead ? -(int32_t)max_lead : lead);
+        int32_t value = (int32_t)target + lead;
+        return value < 0 ? 0 : (value > max_value ? max_value : value);
+    }
+
+    void follow(uint16_t sent, uint16_t interval_ms, uint16_t lag_ms) {
+        if (interval_ms == 0) {
+            return;
+        }
+        uint16_t tau = lag_ms > interval_ms ? lag_ms : interval_ms;
+        needle += ((((int32_t)sent << 4) - needle) * interval_ms) / tau;
+    }
+};
+
 struct SRefueling {
     uint8_t avgFuelFromCluster = 0;
+    uint8_t tankLeft = 0;       // Tank sensor readings the cluster reports in 0x330
+    uint8_t tankRight = 0;
+    bool tankReceived = false;
     const unsigned int counterCycles = 2;
     unsigned int counter = 0;
 };
 
+struct SAmbient {
+    int16_t shown = 0;        // 0.1 °C, what the cluster reports in 0x2CA
+    uint32_t shownTime = 0;   // millis() of the last 0x2CA
+    bool received = false;
+};
+
+// Change to the set of custom check-control lights, one per binary frame. 0 and 1 keep the
+// meaning of the single custom light flag they replace.
+enum CUSTOM_LIGHT_OP : uint8_t {
+    CL_CLEAR = 0,      // Hide all
+    CL_SHOW_ONLY = 1,  // Hide all others and show the ID
+    CL_ADD = 2,        // Show the ID along with the ones already shown
+    CL_REMOVE = 3      // Hide the ID
+};
+
 struct SInput {
     IGNITION_STATE ignition = IG_ON;
     INDICATOR indicator_state = I_OFF;
@@ -135,9 +237,11 @@ struct SInput {
     uint16_t fuel_injection = 0;
     uint8_t water_temp = 0;
     uint8_t oil_temp = 0;
-    uint16_t custom_light = 0;
 
-    bool custom_light_on = false;
+    // Custom check-control lights (ErrorLightID codes) shown in addition to the ones below
+    uint16_t custom_lights[CUSTOM_LIGHTS_MAX] = {};
+    uint8_t custom_light_count = 0;
+
     bool light_shift = false;
     bool light_highbeam = false;
     bool light_lowbeam = true;
@@ -196,4 +300,57 @@ struct SInput {
             bool red_car_blinking = false;
         } acc;
     } cruise;
+
+    // INPUT_FIELD groups changed since inputCacheUpdate() last collected them
+    uint32_t dirty = 0;
+
+    // Stores a parsed value and marks its group dirty if it is not the one already stored
+    template <typename T, typename V>
+    void set(T& field, V value, uint32_t group) {
+        if (field != (T)value) {
+            field = (T)value;
+            dirty |= group;
+        }
+    }
+
+    // Applies a CUSTOM_LIGHT_OP, false if the set is full
+    bool customLight(uint16_t id, uint8_t op) {
+        if (op > CL_REMOVE) {
+            op = CL_SHOW_ONLY;  // Any non-zero value showed the single light
+        }
+
+        uint8_t index = 0;
+        while (index < custom_light_count && custom_lights[index] != id) {
+            index++;
+        }
+        bool found = index < custom_light_count;
+
+        if (op == CL_REMOVE) {
+            if (found) {
+                custom_lights[index] = custom_lights[--custom_light_count];
+                dirty |= IN_CUSTOM_LIGHT;
+            }
+            return true;
+        }
+
+        if (op == CL_CLEAR || (op == CL_SHOW_ONLY && !(found && custom_light_count == 1))) {
+            if (custom_light_count) {
+                custom_light_count = 0;
+                found = false;
+                dirty |= IN_CUSTOM_LIGHT;
+            }
+            if (op == CL_CLEAR) {
+                return true;
+            }
+        }
+
+        if (!found) {
+            if (custom_light_count == CUSTOM_LIGHTS_MAX) {
+                return false;
+            }
+            custom_lights[custom_light_count++] = id;
+            dirty |= IN_CUSTOM_LIGHT;
+        }
+        return true;
+    }
 };